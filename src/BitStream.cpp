@@ -3,89 +3,212 @@
 
 #include "BitStream.h"
 #include <algorithm>
+#include <cassert>
+#include <cstring>
 
-size_t BitStream::Size() const
+BitStream::BitStream(const uint8_t* pData, size_t size, bool complement, bool reverse):
+    BitStream(complement, reverse)
 {
-    return mBytes.size();
+    // The buffer holds just the stream, so a reverse one already sits at its end.
+
+    mBytes.assign(pData, pData + size);
+    mByteCount = size;
+    mIndexBase = reverse ? size : 0;
+
+    mFirstWriteBitCursor = 0;
+    mFirstBitAdjust = (complement && size > 0) ? 1 : 0;
+
+    ResetForRead();
 }
 
-const uint8_t* BitStream::Data() const
+size_t BitStream::Size() const
 {
-    return mBytes.data();
+    return mByteCount;
 }
 
-void BitStream::Reverse()
+const uint8_t* BitStream::Data() const
 {
-    std::reverse(mBytes.begin(), mBytes.end());
+    return mBytes.data() + (mReverse ? mBytes.size() - mByteCount : 0);
 }
 
 void BitStream::ResetForRead()
 {
-    mReadBitMask = 0;
-    mReadBitCursor = 0;
+    mReadBits = 0;
+    mReadBitCount = 0;
     mReadByteCursor = 0;
+    mFirstReadBits = 0;
+
+    if (mFirstWriteBitCursor < mByteCount)
+    {
+        mFirstReadBits = static_cast<uint8_t>(mBytes[GetIndex(mFirstWriteBitCursor)] - mFirstBitAdjust) ^ mComplement;
+    }
 }
 
 void BitStream::ResetForWrite()
 {
     mBytes.clear();
+    mByteCount = 0;
+    mDrainedCount = 0;
+    mIndexBase = 0;
 
-    mWriteBitPos = 0;
+    mWriteBits = 0;
+    mWriteBitCount = 0;
     mWriteBitCursor = 0;
     mFirstWriteBitCursor = SIZE_MAX;
+    mFirstBitAdjust = 0;
 
     ResetForRead();
 }
 
 void BitStream::WriteBit(bool bit)
 {
-    if (mWriteBitPos == 0)
+    // The first bit of a byte reserves its place in the stream. The byte is stored once it is complete.
+
+    if (mWriteBitCount == 0)
+    {
+        mWriteBitCursor = ReserveBytes(1);
+        mFirstWriteBitCursor = std::min(mFirstWriteBitCursor, mWriteBitCursor);
+    }
+
+    mWriteBits = (mWriteBits << 1) | bit;
+
+    if (++mWriteBitCount == 8)
+    {
+        mWriteBitCount = 0;
+        mBytes[GetIndex(mWriteBitCursor)] = static_cast<uint8_t>(mWriteBits) ^ mComplement;
+    }
+}
+
+void BitStream::WriteBits(uint32_t bits, uint32_t count)
+{
+    assert(count <= 32 && (static_cast<uint64_t>(bits) >> count) == 0);
+
+    if (count == 0)
+        return;
+
+    if (mWriteBitCount == 0)
     {
-        mWriteBitCursor = mBytes.size();
+        mWriteBitCursor = ReserveBytes(1);
         mFirstWriteBitCursor = std::min(mFirstWriteBitCursor, mWriteBitCursor);
-        mBytes.emplace_back(mComplement);
     }
 
-    mWriteBitPos = --mWriteBitPos & 7;
-    mBytes[mWriteBitCursor] ^= bit << mWriteBitPos;
+    // The accumulator holds the pending bits of the reserved byte and the new ones (at most 39 bits).
+
+    mWriteBits = (mWriteBits << count) | bits;
+    mWriteBitCount += count;
+
+    if (mWriteBitCount < 8)
+        return;
+
+    mWriteBitCount -= 8;
+    mBytes[GetIndex(mWriteBitCursor)] = static_cast<uint8_t>(mWriteBits >> mWriteBitCount) ^ mComplement;
+
+    if (mWriteBitCount == 0)
+        return;
+
+    // Further bytes started by this call are consecutive, so they are reserved together at the end of the stream.
+
+    mWriteBitCursor = ReserveBytes((mWriteBitCount + 7) >> 3);
+
+    for (; mWriteBitCount >= 8; mWriteBitCursor++)
+    {
+        mWriteBitCount -= 8;
+        mBytes[GetIndex(mWriteBitCursor)] = static_cast<uint8_t>(mWriteBits >> mWriteBitCount) ^ mComplement;
+    }
 }
 
 void BitStream::WriteByte(uint8_t byte)
 {
-    mBytes.emplace_back(byte);
+    mBytes[GetIndex(ReserveBytes(1))] = byte;
 }
 
-uint32_t BitStream::ReadBit()
+void BitStream::WriteBytes(const uint8_t* pBytes, size_t count)
 {
-    mReadBitMask >>= 1;
+    if (count == 0)
+        return;
+
+    size_t cursor = ReserveBytes(count);
+
+    if (mReverse)
+    {
+        std::reverse_copy(pBytes, pBytes + count, mBytes.data() + GetIndex(cursor + count - 1));
+    }
+    else
+    {
+        memcpy(mBytes.data() + GetIndex(cursor), pBytes, count);
+    }
+}
+
+void BitStream::FlushBits()
+{
+    // Unused bits of the last byte keep their initial value.
+
+    if (mWriteBitCount > 0)
+    {
+        mBytes[GetIndex(mWriteBitCursor)] = static_cast<uint8_t>(mWriteBits << (8 - mWriteBitCount)) ^ mComplement;
+        mWriteBitCount = 0;
+    }
+
+    if (mComplement == 0 || mByteCount == 0)
+        return;
+
+    // A drained first bit byte has already been corrected.
 
-    if (mReadBitMask == 0)
+    if (mFirstWriteBitCursor != SIZE_MAX && mFirstWriteBitCursor >= mDrainedCount)
     {
-        mReadBitMask = 128;
-        mReadBitCursor = mReadByteCursor++;
+        mBytes[GetIndex(mFirstWriteBitCursor)]++;
+        mFirstBitAdjust++;
     }
+}
+
+void BitStream::DrainBytes(std::vector<uint8_t>& output)
+{
+    assert(!mReverse);
+
+    // Everything before a pending bit byte is complete.
+
+    size_t endCursor = (mWriteBitCount > 0) ? mWriteBitCursor : mByteCount;
+
+    if (endCursor <= mDrainedCount)
+        return;
 
-    uint8_t bits = mBytes[mReadBitCursor];
-    if (mReadBitCursor == mFirstWriteBitCursor)
+    size_t count = endCursor - mDrainedCount;
+    size_t outputSize = output.size();
+    output.insert(output.end(), mBytes.data(), mBytes.data() + count);
+
+    if (mComplement != 0 && mFirstBitAdjust == 0 && mFirstWriteBitCursor >= mDrainedCount && mFirstWriteBitCursor < endCursor)
     {
-        bits--;
+        output[outputSize + mFirstWriteBitCursor - mDrainedCount]++;
     }
 
-    return ((bits ^ mComplement) & mReadBitMask) > 0;
+    memmove(mBytes.data(), mBytes.data() + count, mByteCount - endCursor);
+    mDrainedCount = endCursor;
+    mIndexBase = 0 - mDrainedCount;
 }
 
-uint8_t BitStream::ReadByte()
+size_t BitStream::ReserveBytes(size_t count)
 {
-    return mBytes[mReadByteCursor++];
+    if (mBytes.size() - (mByteCount - mDrainedCount) < count)
+    {
+        GrowBytes(count);
+    }
+
+    size_t cursor = mByteCount;
+    mByteCount += count;
+
+    return cursor;
 }
 
-void BitStream::FlushBits()
+void BitStream::GrowBytes(size_t count)
 {
-    if (mComplement == 0 || mBytes.empty())
-        return;
+    size_t oldSize = mBytes.size();
+    mBytes.resize(std::max<size_t>(std::max<size_t>(oldSize * 2, 256), mByteCount - mDrainedCount + count));
+    mIndexBase = mReverse ? mBytes.size() : 0 - mDrainedCount;
+
+    // Reverse streams move to the end of the buffer.
 
-    if (mFirstWriteBitCursor != SIZE_MAX)
+    if (mReverse && mByteCount > 0)
     {
-        mBytes[mFirstWriteBitCursor]++;
+        memmove(mBytes.data() + mBytes.size() - mByteCount, mBytes.data() + oldSize - mByteCount, mByteCount);
     }
 }
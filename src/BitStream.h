@@ -4,49 +4,200 @@
 #ifndef BIT_STREAM_H
 #define BIT_STREAM_H
 
+#include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 
 class BitStream
 {
 public:
 
-    BitStream(bool complement = false)
+    // Reverse streams are stored backwards from the end of the buffer. Data() then returns them in the file
+    // layout, which the reverse depackers read from the last byte towards the first one.
+
+    BitStream(bool complement = false, bool reverse = false)
     {
         mComplement = complement ? 0xFF : 0;
+        mReverse = reverse;
+        mIndexMask = reverse ? SIZE_MAX : 0;
         ResetForWrite();
     }
 
+    // Wraps the bytes of a complete stream in the layout of Data(), e.g. loaded from a file, for reading. The first
+    // byte in stream order must be a bit byte (as in the streams of all formats with bits), so that the correction
+    // of FlushBits can be undone.
+
+    BitStream(const uint8_t* pData, size_t size, bool complement = false, bool reverse = false);
+
     BitStream(BitStream&&) noexcept = default;
     BitStream& operator = (BitStream&&) noexcept = default;
 
     size_t Size() const;
     const uint8_t* Data() const;
-    void Reverse();
 
     void ResetForRead();
     void ResetForWrite();
 
+    // Bits are collected in an accumulator and stored a byte at a time. Each bit byte is reserved in the stream
+    // when its first bit is written, so raw bytes written afterwards follow it. WriteBits takes up to 32 bits
+    // (most significant first) and the unused high bits must be zero.
+
     void WriteBit(bool bit);
+    void WriteBits(uint32_t bits, uint32_t count);
     void WriteByte(uint8_t byte);
+    void WriteBytes(const uint8_t* pBytes, size_t count);
+
+    // Bits are read from the current bit byte and, once it runs out, from the bytes at the read cursor. Peeked
+    // bits may therefore extend into bytes that only become bit bytes if no raw byte is read in between. Up to
+    // 16 bits per call, reads beyond the end of the stream yield zeros.
 
     uint32_t ReadBit();
+    uint32_t ReadBits(uint32_t count);
+    uint32_t PeekBits(uint32_t count) const;
+    void SkipBits(uint32_t count);
+
+    // Raw bytes past the end of the stream read as zeros and ReadBytes fails. Either case can be detected once
+    // decoding stops. ReadBytes copies the bytes as they are stored, so in reverse streams the last byte read
+    // comes first.
+
     uint8_t ReadByte();
+    bool ReadBytes(uint8_t* pBytes, size_t count);
+    bool IsReadPastEnd() const { return mReadByteCursor > mByteCount; }
+
+    // Stores the pending bits. Must be called after the last bit is written.
 
     void FlushBits();
 
+    // Moves the bytes that can no longer change (all of them after FlushBits) to the output, so a forward stream
+    // can be written out while it grows. The first bit byte is moved with the correction of FlushBits. Size()
+    // keeps counting the moved bytes, but Data() and reads only cover the rest.
+
+    void DrainBytes(std::vector<uint8_t>& output);
+
 private:
 
+    // The buffer grows geometrically and only mByteCount bytes at its start (or end) belong to the stream, so
+    // writes are plain stores. Cursors count bytes in stream order and map to buffer indices without branches
+    // (a reverse stream complements the cursor and adds the buffer size, a drained one subtracts the number of
+    // drained bytes).
+
+    size_t ReserveBytes(size_t count);
+    void GrowBytes(size_t count);
+    uint8_t LoadBitByte(size_t cursor) const;
+    size_t GetIndex(size_t cursor) const { return (cursor ^ mIndexMask) + mIndexBase; }
+
     std::vector<uint8_t> mBytes;
+    size_t mByteCount;
+    size_t mDrainedCount;
     uint8_t mComplement;
+    bool mReverse;
+    size_t mIndexMask;
+    size_t mIndexBase;
 
-    uint8_t mWriteBitPos;
+    uint64_t mWriteBits;
+    uint32_t mWriteBitCount;
     size_t mWriteBitCursor;
     size_t mFirstWriteBitCursor;
+    uint8_t mFirstBitAdjust;
+
+    // The unread bits of the current bit byte are the lowest mReadBitCount bits. The first bit byte is
+    // corrected for FlushBits when the stream is reset for reading.
 
-    uint8_t mReadBitMask;
-    size_t mReadBitCursor;
+    uint32_t mReadBits;
+    uint32_t mReadBitCount;
     size_t mReadByteCursor;
+    uint8_t mFirstReadBits;
 };
 
+// Reads are inlined, since the decoders read every code through them.
+
+inline uint32_t BitStream::ReadBit()
+{
+    if (mReadBitCount == 0)
+    {
+        mReadBits = LoadBitByte(mReadByteCursor++);
+        mReadBitCount = 8;
+    }
+
+    return (mReadBits >> --mReadBitCount) & 1;
+}
+
+inline uint32_t BitStream::ReadBits(uint32_t count)
+{
+    uint32_t bits = PeekBits(count);
+    SkipBits(count);
+
+    return bits;
+}
+
+inline uint32_t BitStream::PeekBits(uint32_t count) const
+{
+    assert(count <= 16);
+
+    uint32_t bits = mReadBits & ((1 << mReadBitCount) - 1);
+    uint32_t bitCount = mReadBitCount;
+
+    for (size_t cursor = mReadByteCursor; bitCount < count; cursor++)
+    {
+        bits = (bits << 8) | LoadBitByte(cursor);
+        bitCount += 8;
+    }
+
+    return bits >> (bitCount - count);
+}
+
+inline void BitStream::SkipBits(uint32_t count)
+{
+    while (count > mReadBitCount)
+    {
+        count -= mReadBitCount;
+        mReadBits = LoadBitByte(mReadByteCursor++);
+        mReadBitCount = 8;
+    }
+
+    mReadBitCount -= count;
+}
+
+inline uint8_t BitStream::ReadByte()
+{
+    uint8_t byte = (mReadByteCursor < mByteCount) ? mBytes[GetIndex(mReadByteCursor)] : 0;
+    mReadByteCursor++;
+
+    return byte;
+}
+
+inline bool BitStream::ReadBytes(uint8_t* pBytes, size_t count)
+{
+    if (mReadByteCursor > mByteCount || count > mByteCount - mReadByteCursor)
+    {
+        mReadByteCursor = mByteCount + 1;
+        return false;
+    }
+
+    const uint8_t* pSource = mBytes.data() + GetIndex(mReverse ? mReadByteCursor + count - 1 : mReadByteCursor);
+    mReadByteCursor += count;
+
+    if (count > 16)
+    {
+        memcpy(pBytes, pSource, count);
+        return true;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        pBytes[i] = pSource[i];
+    }
+
+    return true;
+}
+
+inline uint8_t BitStream::LoadBitByte(size_t cursor) const
+{
+    if (cursor >= mByteCount)
+        return 0;
+
+    return (cursor == mFirstWriteBitCursor) ? mFirstReadBits : mBytes[GetIndex(cursor)] ^ mComplement;
+}
+
 #endif // BIT_STREAM_H
@@ -16,6 +16,19 @@ struct Match
     uint16_t offset;
 };
 
+// All lengths from minLength to maxLength are available at the same offset.
+
+struct MatchRange
+{
+    MatchRange(uint16_t minLength, uint16_t maxLength, uint16_t offset):
+        minLength{minLength}, maxLength{maxLength}, offset{offset}
+    {}
+
+    uint16_t minLength;
+    uint16_t maxLength;
+    uint16_t offset;
+};
+
 struct ParseStep
 {
     ParseStep(uint16_t length, uint16_t offset):
@@ -26,4 +39,39 @@ struct ParseStep
     uint16_t offset;
 };
 
+// Work done by the exact BX0 and BX2 parse. States whose cost plus a lower bound on the rest of the input
+// exceeds the cost of an approximate parse are pruned. All costs are in bits.
+
+struct ParserStats
+{
+    uint32_t upperBound = 0;
+    uint32_t lowerBound = 0;
+    uint32_t cost = 0;
+    uint64_t relaxations = 0;
+    uint64_t prunedRelaxations = 0;
+};
+
+// Parser settings. Apart from the beam width and the block size, they only affect speed and memory use.
+
+struct ParserOptions
+{
+    // Number of threads that relax matches (BX0 and BX2 only).
+
+    uint32_t threadCount = 1;
+
+    // Approximate the parse by keeping only this many of the cheapest repeat offset states at each position (BX0
+    // and BX2 only, zero selects the exact parse).
+
+    uint32_t beamWidth = 0;
+
+    // Split the input into blocks of this size that are parsed concurrently on the threads above. Matches may
+    // reach back into the preceding blocks (zero parses the input as a whole).
+
+    uint32_t blockSize = 0;
+
+    // Receives the statistics of the exact parse if set.
+
+    ParserStats* pStats = nullptr;
+};
+
 #endif // COMMON_TYPES_H
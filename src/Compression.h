@@ -4,10 +4,58 @@
 #ifndef COMPRESSION_H
 #define COMPRESSION_H
 
+#include <memory>
 #include "BitStream.h"
+#include "CommonTypes.h"
 #include "Formats.h"
+#include "MatchFinder.h"
 
-BitStream Compress(const uint8_t* pInput, uint32_t inputSize, const Format& format);
+BitStream Compress(const uint8_t* pInput, uint32_t inputSize, const Format& format, MatchFinderId finderId = MatchFinderId::WordChains, const ParserOptions& parserOptions = {});
+
+// Compresses with a prebuilt matcher of the input, so that several runs can share it. The matcher may have a
+// wider window and longer matches than the format, it is then restricted to the format limits. The input is
+// parsed as a whole (the block size is ignored).
+
+BitStream Compress(const uint8_t* pInput, uint32_t inputSize, const Format& format, const MatchFinder& matcher, const ParserOptions& parserOptions = {});
+
+// Returns an estimate of the peak memory in bytes that Compress takes for the input. It is dominated by the path
+// nodes of the BX0 and BX2 parse and only takes a single pass over the input.
+
+size_t EstimateCompressionMemory(const uint8_t* pInput, uint32_t inputSize, const Format& format, const ParserOptions& parserOptions = {});
 std::vector<uint8_t> Decompress(BitStream& stream, const Format& format, uint32_t inputSize = 0);
 
+// Decompresses into a caller-provided buffer and returns the decompressed size. Without an end marker, decoding
+// stops once the buffer is full. Returns zero if the stream is corrupt or does not fit.
+
+size_t Decompress(BitStream& stream, const Format& format, uint8_t* pOutput, size_t outputSize);
+
+// Same as above for the stream bytes written by Compress (Data() of the returned stream), e.g. loaded from a file.
+
+size_t Decompress(const uint8_t* pStream, size_t streamSize, const Format& format, uint8_t* pOutput, size_t outputSize);
+
+// Compresses input of any size in chunks, with memory bounded by the format window (LZM and EF8 only). The
+// completed part of the stream is appended to the output after each call. The stream is the same as the one of
+// Compress, unless the coding paths disagree for more than 16 KiB, which costs a few bytes each time.
+
+class StreamCompressor
+{
+public:
+
+    virtual ~StreamCompressor() = default;
+
+    // Returns null for formats that need the whole input (BX0, BX2 and reverse streams).
+
+    static std::unique_ptr<StreamCompressor> Create(const Format& format);
+
+    virtual void Write(const uint8_t* pInput, size_t inputSize, std::vector<uint8_t>& output) = 0;
+
+    // Parses the rest of the input and appends the end of the stream.
+
+    virtual void Finish(std::vector<uint8_t>& output) = 0;
+
+protected:
+
+    StreamCompressor() = default;
+};
+
 #endif // COMPRESSION_H
@@ -3,17 +3,30 @@
 
 #include "Compression.h"
 #include <algorithm>
+#include <functional>
 #include "ExhaustiveParser.h"
 #include "OptimalParser.h"
+#include "StreamingParser.h"
 #include "UniversalCodes.h"
+#include "WorkerPool.h"
 
-BitStream EncodeLZM(const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
+// A literal cannot follow another one in the repeat offset formats. Consecutive literals (a run longer than a
+// parse step can hold) are written as one, the index then points to the last of them.
+
+static uint32_t GetLiteralRunLength(const std::vector<ParseStep>& parse, size_t& index)
 {
-    if (format.Id() != FormatId::LZM || parse.empty())
-        return {};
+    uint32_t length = parse[index].length;
 
-    BitStream stream;
+    while (index + 1 < parse.size() && parse[index + 1].offset == 0)
+    {
+        length += parse[++index].length;
+    }
 
+    return length;
+}
+
+static void EncodeStepsLZM(BitStream& stream, const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
+{
     for (const ParseStep& parseStep: parse)
     {
         uint8_t length = parseStep.length - format.ExtendLength();
@@ -31,28 +44,34 @@ BitStream EncodeLZM(const uint8_t* pInput, const std::vector<ParseStep>& parse,
         {
             stream.WriteByte((length << 1) | 1);
 
-            for (uint16_t i = 0; i < parseStep.length; i++)
-            {
-                stream.WriteByte(*pInput++);
-            }
+            stream.WriteBytes(pInput, parseStep.length);
+            pInput += parseStep.length;
         }
     }
+}
 
+static void EncodeEndLZM(BitStream& stream, const Format& format)
+{
     if (format.EndMarker())
     {
         stream.WriteByte(0);
     }
-
-    return stream;
 }
 
-BitStream EncodeEF8(const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
+BitStream EncodeLZM(const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
 {
-    if (format.Id() != FormatId::EF8 || parse.empty())
+    if (format.Id() != FormatId::LZM || parse.empty())
         return {};
 
-    BitStream stream(!format.NaturalStream());
+    BitStream stream(false, format.Reverse());
+    EncodeStepsLZM(stream, pInput, parse, format);
+    EncodeEndLZM(stream, format);
 
+    return stream;
+}
+
+static void EncodeStepsEF8(BitStream& stream, const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
+{
     for (const ParseStep& parseStep: parse)
     {
         if (parseStep.offset)
@@ -70,19 +89,31 @@ BitStream EncodeEF8(const uint8_t* pInput, const std::vector<ParseStep>& parse,
             EncodeElias(stream, parseStep.length);
             stream.WriteBit(1);
 
-            for (uint16_t i = 0; i < parseStep.length; i++)
-            {
-                stream.WriteByte(*pInput++);
-            }
+            stream.WriteBytes(pInput, parseStep.length);
+            pInput += parseStep.length;
         }
     }
+}
 
+static void EncodeEndEF8(BitStream& stream, const Format& format)
+{
     if (format.EndMarker())
     {
         EncodeElias(stream, 256);
     }
 
     stream.FlushBits();
+}
+
+BitStream EncodeEF8(const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
+{
+    if (format.Id() != FormatId::EF8 || parse.empty())
+        return {};
+
+    BitStream stream(!format.NaturalStream(), format.Reverse());
+    EncodeStepsEF8(stream, pInput, parse, format);
+    EncodeEndEF8(stream, format);
+
     return stream;
 }
 
@@ -91,12 +122,14 @@ BitStream EncodeBX0(const uint8_t* pInput, const std::vector<ParseStep>& parse,
     if (format.Id() != FormatId::BX0 || parse.empty())
         return {};
 
-    BitStream stream(!format.NaturalStream());
+    BitStream stream(!format.NaturalStream(), format.Reverse());
     uint16_t repOffset = 0;
     bool wasLiteral = false;
 
-    for (const ParseStep& parseStep: parse)
+    for (size_t i = 0; i < parse.size(); i++)
     {
+        const ParseStep& parseStep = parse[i];
+
         if (parseStep.offset)
         {
             if (wasLiteral && (parseStep.offset == repOffset))
@@ -120,17 +153,22 @@ BitStream EncodeBX0(const uint8_t* pInput, const std::vector<ParseStep>& parse,
         }
         else
         {
+            uint32_t length = GetLiteralRunLength(parse, i);
+
+            // The depackers keep the literal length in 16 bits.
+
+            if (length > format.MaxLiteralLength())
+                return {};
+
             if (stream.Size())
             {
                 stream.WriteBit(1);
             }
 
-            EncodeElias(stream, parseStep.length);
+            EncodeElias(stream, length);
 
-            for (uint16_t i = 0; i < parseStep.length; i++)
-            {
-                stream.WriteByte(*pInput++);
-            }
+            stream.WriteBytes(pInput, length);
+            pInput += length;
         }
 
         wasLiteral = !parseStep.offset;
@@ -151,12 +189,14 @@ BitStream EncodeBX2(const uint8_t* pInput, const std::vector<ParseStep>& parse,
     if (format.Id() != FormatId::BX2 || parse.empty())
         return {};
 
-    BitStream stream(!format.NaturalStream());
+    BitStream stream(!format.NaturalStream(), format.Reverse());
     uint16_t repOffset = 0;
     bool wasLiteral = false;
 
-    for (const ParseStep& parseStep: parse)
+    for (size_t i = 0; i < parse.size(); i++)
     {
+        const ParseStep& parseStep = parse[i];
+
         if (parseStep.offset)
         {
             if (wasLiteral && (parseStep.offset == repOffset))
@@ -176,13 +216,16 @@ BitStream EncodeBX2(const uint8_t* pInput, const std::vector<ParseStep>& parse,
         }
         else
         {
-            EncodeElias(stream, parseStep.length);
+            uint32_t length = GetLiteralRunLength(parse, i);
+
+            if (length > format.MaxLiteralLength())
+                return {};
+
+            EncodeElias(stream, length);
             stream.WriteBit(1);
 
-            for (uint16_t i = 0; i < parseStep.length; i++)
-            {
-                stream.WriteByte(*pInput++);
-            }
+            stream.WriteBytes(pInput, length);
+            pInput += length;
         }
 
         wasLiteral = !parseStep.offset;
@@ -199,36 +242,341 @@ BitStream EncodeBX2(const uint8_t* pInput, const std::vector<ParseStep>& parse,
     return stream;
 }
 
-BitStream Compress(const uint8_t* pInput, uint32_t inputSize, const Format& format)
+static std::vector<ParseStep> ParseInput(const uint8_t* pInput, uint32_t inputSize, const Format& format, const MatchFinder& matcher, const ParserOptions& parserOptions)
 {
-    if (pInput == nullptr || inputSize == 0)
-        return {};
+    switch (format.Id())
+    {
+        case FormatId::LZM:
+            return OptimalParser::Parse(pInput, inputSize, static_cast<const FormatLZM&>(format), matcher);
+
+        case FormatId::EF8:
+            return OptimalParser::Parse(pInput, inputSize, static_cast<const FormatEF8&>(format), matcher);
+
+        case FormatId::BX0:
+            return ExhaustiveParser::Parse(pInput, inputSize, static_cast<const FormatBX0&>(format), matcher, parserOptions);
+
+        case FormatId::BX2:
+            return ExhaustiveParser::Parse(pInput, inputSize, static_cast<const FormatBX2&>(format), matcher, parserOptions);
+    }
+
+    return {};
+}
+
+// The block parses of the repeat offset formats may meet in a literal run that is longer than the format allows.
+// Such a run is split by the latest match that keeps the literal before it within the limit, which only costs a
+// few bits in the rare case of incompressible input. Fails if no such match exists.
+
+static bool LimitLiteralRuns(std::vector<ParseStep>& parse, const uint8_t* pInput, const Format& format, MatchFinderId finderId)
+{
+    uint32_t maxLength = format.MaxLiteralLength();
+    std::vector<ParseStep> limitedParse;
+    std::vector<MatchRange> matches;
+    uint32_t inputPos = 0;
+
+    for (size_t i = 0; i < parse.size(); i++)
+    {
+        size_t firstIndex = i;
+        uint32_t length = parse[i].offset ? parse[i].length : GetLiteralRunLength(parse, i);
+
+        if (parse[i].offset || length <= maxLength)
+        {
+            limitedParse.insert(limitedParse.end(), parse.begin() + firstIndex, parse.begin() + i + 1);
+            inputPos += length;
+            continue;
+        }
+
+        uint32_t historySize = std::min<uint32_t>(inputPos, format.MaxMatchOffset());
+
+        std::unique_ptr<MatchFinder> spMatcher = MatchFinder::Create(finderId, pInput + inputPos, length, format.MinMatchLength(), format.MaxMatchLength(), format.MaxMatchOffset(), historySize);
+        if (spMatcher == nullptr)
+            return false;
+
+        // Matches end within the run, so the steps that follow it stay valid.
+
+        uint32_t literalPos = 0;
+
+        while (length - literalPos > maxLength)
+        {
+            uint32_t matchPos = literalPos + maxLength;
+            uint16_t matchLength = 0;
+            uint16_t matchOffset = 0;
+
+            for (; matchPos > literalPos; matchPos--)
+            {
+                spMatcher->GetMatches(matches, matchPos);
+
+                for (const MatchRange& match: matches)
+                {
+                    uint16_t clampedLength = static_cast<uint16_t>(std::min<uint32_t>(match.maxLength, length - matchPos));
+
+                    if (clampedLength >= match.minLength && clampedLength > matchLength)
+                    {
+                        matchLength = clampedLength;
+                        matchOffset = match.offset;
+                    }
+                }
+
+                if (matchLength != 0)
+                    break;
+            }
+
+            if (matchLength == 0)
+                return false;
+
+            limitedParse.emplace_back(static_cast<uint16_t>(matchPos - literalPos), 0);
+            limitedParse.emplace_back(matchLength, matchOffset);
+            literalPos = matchPos + matchLength;
+        }
+
+        if (literalPos < length)
+        {
+            limitedParse.emplace_back(static_cast<uint16_t>(length - literalPos), 0);
+        }
+
+        inputPos += length;
+    }
+
+    parse.swap(limitedParse);
+    return true;
+}
+
+// Blocks are parsed independently, each one with the preceding input up to the maximum offset as its history.
+// The parses are joined into a single parse of the whole input, so the stream needs no block structure.
+
+static std::vector<ParseStep> ParseBlocks(const uint8_t* pInput, uint32_t inputSize, const Format& format, MatchFinderId finderId, const ParserOptions& parserOptions)
+{
+    uint32_t blockSize = parserOptions.blockSize;
+    uint32_t blockCount = (inputSize + blockSize - 1) / blockSize;
+
+    // Threads left over by the blocks relax matches within them.
+
+    uint32_t threadCount = std::max(parserOptions.threadCount, 1u);
+
+    ParserOptions blockOptions = parserOptions;
+    blockOptions.threadCount = std::max(threadCount / blockCount, 1u);
+    blockOptions.blockSize = 0;
+
+    std::vector<std::vector<ParseStep>> blockParses(blockCount);
+    std::vector<ParserStats> blockStats(blockCount);
+
+    WorkerPool workerPool(std::min(threadCount, blockCount));
+
+    workerPool.Run(blockCount, [&](uint32_t blockIndex)
+    {
+        uint32_t blockPos = blockIndex * blockSize;
+        uint32_t size = std::min(blockSize, inputSize - blockPos);
+        uint32_t historySize = std::min<uint32_t>(blockPos, format.MaxMatchOffset());
+
+        std::unique_ptr<MatchFinder> spMatcher = MatchFinder::Create(finderId, pInput + blockPos, size, format.MinMatchLength(), format.MaxMatchLength(), format.MaxMatchOffset(), historySize);
+        if (spMatcher == nullptr)
+            return;
+
+        ParserOptions options = blockOptions;
+        options.pStats = (parserOptions.pStats != nullptr) ? &blockStats[blockIndex] : nullptr;
+
+        blockParses[blockIndex] = ParseInput(pInput + blockPos, size, format, *spMatcher, options);
+    });
+
+    // Literals that meet at a block boundary are merged if the format allows the combined length.
 
-    BitStream stream;
     std::vector<ParseStep> parse;
 
+    for (const std::vector<ParseStep>& blockParse: blockParses)
+    {
+        if (blockParse.empty())
+            return {};
+
+        auto iParseStep = blockParse.begin();
+
+        if (!parse.empty() && parse.back().offset == 0 && iParseStep->offset == 0 && parse.back().length + iParseStep->length <= format.MaxLiteralLength())
+        {
+            parse.back().length += iParseStep->length;
+            iParseStep++;
+        }
+
+        parse.insert(parse.end(), iParseStep, blockParse.end());
+    }
+
+    if (format.SupportsRepOffset() && !LimitLiteralRuns(parse, pInput, format, finderId))
+        return {};
+
+    if (parserOptions.pStats != nullptr)
+    {
+        *parserOptions.pStats = {};
+
+        for (const ParserStats& stats: blockStats)
+        {
+            parserOptions.pStats->upperBound += stats.upperBound;
+            parserOptions.pStats->lowerBound += stats.lowerBound;
+            parserOptions.pStats->cost += stats.cost;
+            parserOptions.pStats->relaxations += stats.relaxations;
+            parserOptions.pStats->prunedRelaxations += stats.prunedRelaxations;
+        }
+    }
+
+    return parse;
+}
+
+static BitStream EncodeParse(const uint8_t* pInput, const std::vector<ParseStep>& parse, const Format& format)
+{
+    if (parse.empty())
+        return {};
+
     switch (format.Id())
     {
         case FormatId::LZM:
-            parse = OptimalParser::Parse(pInput, inputSize, format);
-            stream = EncodeLZM(pInput, parse, format);
-            break;
+            return EncodeLZM(pInput, parse, format);
 
         case FormatId::EF8:
-            parse = OptimalParser::Parse(pInput, inputSize, format);
-            stream = EncodeEF8(pInput, parse, format);
-            break;
+            return EncodeEF8(pInput, parse, format);
 
         case FormatId::BX0:
-            parse = ExhaustiveParser::Parse(pInput, inputSize, format);
-            stream = EncodeBX0(pInput, parse, format);
-            break;
+            return EncodeBX0(pInput, parse, format);
 
         case FormatId::BX2:
-            parse = ExhaustiveParser::Parse(pInput, inputSize, format);
-            stream = EncodeBX2(pInput, parse, format);
+            return EncodeBX2(pInput, parse, format);
+    }
+
+    return {};
+}
+
+BitStream Compress(const uint8_t* pInput, uint32_t inputSize, const Format& format, MatchFinderId finderId, const ParserOptions& parserOptions)
+{
+    if (pInput == nullptr || inputSize == 0)
+        return {};
+
+    if (parserOptions.blockSize != 0 && inputSize > parserOptions.blockSize)
+        return EncodeParse(pInput, ParseBlocks(pInput, inputSize, format, finderId, parserOptions), format);
+
+    // Precompute all available matches for each input position.
+
+    std::unique_ptr<MatchFinder> spMatcher = MatchFinder::Create(finderId, pInput, inputSize, format.MinMatchLength(), format.MaxMatchLength(), format.MaxMatchOffset());
+    if (spMatcher == nullptr)
+        return {};
+
+    return EncodeParse(pInput, ParseInput(pInput, inputSize, format, *spMatcher, parserOptions), format);
+}
+
+BitStream Compress(const uint8_t* pInput, uint32_t inputSize, const Format& format, const MatchFinder& matcher, const ParserOptions& parserOptions)
+{
+    if (pInput == nullptr || inputSize == 0)
+        return {};
+
+    std::unique_ptr<MatchFinder> spMatcher = MatchFinder::Create(matcher, format.MinMatchLength(), format.MaxMatchLength(), format.MaxMatchOffset());
+    if (spMatcher == nullptr)
+        return {};
+
+    return EncodeParse(pInput, ParseInput(pInput, inputSize, format, *spMatcher, parserOptions), format);
+}
+
+// The matchers, the parse of LZM and EF8 and the stream take about this many bytes per input position (the word
+// chains may take more on very repetitive inputs).
+
+constexpr size_t POSITION_MEMORY = 128;
+
+size_t EstimateCompressionMemory(const uint8_t* pInput, uint32_t inputSize, const Format& format, const ParserOptions& parserOptions)
+{
+    if (pInput == nullptr || inputSize == 0)
+        return 0;
+
+    bool blockMode = parserOptions.blockSize != 0 && inputSize > parserOptions.blockSize;
+    uint32_t blockSize = blockMode ? parserOptions.blockSize : inputSize;
+    uint32_t blockCount = (inputSize + blockSize - 1) / blockSize;
+
+    std::vector<size_t> blockMemory(blockCount);
+
+    for (uint32_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+    {
+        uint32_t blockPos = blockIndex * blockSize;
+        uint32_t size = std::min(blockSize, inputSize - blockPos);
+        uint32_t historySize = std::min<uint32_t>(blockPos, format.MaxMatchOffset());
+
+        blockMemory[blockIndex] = (historySize + size) * POSITION_MEMORY;
+
+        if (format.SupportsRepOffset())
+        {
+            blockMemory[blockIndex] += ExhaustiveParser::EstimateMemory(pInput + blockPos, size, format, parserOptions, historySize);
+        }
+    }
+
+    // Each thread parses a block at a time, so the largest blocks may be parsed together.
+
+    uint32_t concurrentCount = std::min(std::max(parserOptions.threadCount, 1u), blockCount);
+    std::partial_sort(blockMemory.begin(), blockMemory.begin() + concurrentCount, blockMemory.end(), std::greater<size_t>());
+
+    size_t memory = 0;
+
+    for (uint32_t blockIndex = 0; blockIndex < concurrentCount; blockIndex++)
+    {
+        memory += blockMemory[blockIndex];
+    }
+
+    return memory;
+}
+
+// Settled steps are encoded right away and the completed bytes of the stream are handed out after each write.
+
+template<class FormatType>
+class StreamCompressorImpl final: public StreamCompressor
+{
+public:
+
+    using EncodeSteps = void (*)(BitStream&, const uint8_t*, const std::vector<ParseStep>&, const Format&);
+    using EncodeEnd = void (*)(BitStream&, const Format&);
+
+    StreamCompressorImpl(const FormatType& format, bool complement, EncodeSteps encodeSteps, EncodeEnd encodeEnd):
+        mFormat{format},
+        mStream(complement),
+        mParser(format, [this, encodeSteps](const uint8_t* pInput, const std::vector<ParseStep>& parse)
+        {
+            encodeSteps(mStream, pInput, parse, mFormat);
+        }),
+        mEncodeEnd{encodeEnd}
+    {}
+
+    void Write(const uint8_t* pInput, size_t inputSize, std::vector<uint8_t>& output) override
+    {
+        mParser.Write(pInput, inputSize);
+        mStream.DrainBytes(output);
+    }
+
+    void Finish(std::vector<uint8_t>& output) override
+    {
+        mParser.Finish();
+
+        if (mParser.InputSize() != 0)
+        {
+            mEncodeEnd(mStream, mFormat);
+        }
+
+        mStream.DrainBytes(output);
+    }
+
+private:
+
+    const FormatType& mFormat;
+    BitStream mStream;
+    StreamingParser<FormatType> mParser;
+    EncodeEnd mEncodeEnd;
+};
+
+std::unique_ptr<StreamCompressor> StreamCompressor::Create(const Format& format)
+{
+    if (format.Reverse())
+        return nullptr;
+
+    switch (format.Id())
+    {
+        case FormatId::LZM:
+            return std::unique_ptr<StreamCompressor>(new StreamCompressorImpl<FormatLZM>(static_cast<const FormatLZM&>(format), false, EncodeStepsLZM, EncodeEndLZM));
+
+        case FormatId::EF8:
+            return std::unique_ptr<StreamCompressor>(new StreamCompressorImpl<FormatEF8>(static_cast<const FormatEF8&>(format), !format.NaturalStream(), EncodeStepsEF8, EncodeEndEF8));
+
+        case FormatId::BX0:
+        case FormatId::BX2:
             break;
     }
 
-    return stream;
+    return nullptr;
 }
@@ -3,15 +3,177 @@
 
 #include "Compression.h"
 #include <algorithm>
+#include <cstring>
 #include "UniversalCodes.h"
 
-std::vector<uint8_t> DecodeLZM(BitStream& stream, const Format& format, uint32_t inputSize)
+// The decoders write into a buffer of known size. Each block is checked against the space left and the data
+// written so far, the copies themselves are unchecked. Every block consumes at least one bit, so a corrupt stream
+// eventually reads past its end, which is checked once per block.
+
+static constexpr size_t OUTPUT_TOO_SMALL = SIZE_MAX;
+
+// Short matches that do not overlap their source are copied as a fixed 16-byte block if there is enough space
+// left. The excess bytes land in the part of the buffer that is yet to be decoded.
+
+static constexpr size_t SHORT_MATCH_LENGTH = 16;
+
+// Forward output fills the buffer from its start. Matches copy from lower addresses.
+
+class ForwardOutput
+{
+public:
+
+    ForwardOutput(uint8_t* pOutput, size_t outputSize) : mpBegin(pOutput), mpEnd(pOutput + outputSize), mpData(pOutput) {}
+
+    size_t Size() const { return mpData - mpBegin; }
+    size_t Space() const { return mpEnd - mpData; }
+
+    bool ReadLiteral(BitStream& stream, size_t length)
+    {
+        if (!stream.ReadBytes(mpData, length))
+            return false;
+
+        mpData += length;
+        return true;
+    }
+
+    void CopyMatch(size_t offset, size_t length)
+    {
+        uint8_t* pData = mpData;
+        const uint8_t* pMatch = pData - offset;
+        mpData += length;
+
+        if (length <= SHORT_MATCH_LENGTH)
+        {
+            if (offset >= SHORT_MATCH_LENGTH && static_cast<size_t>(mpEnd - pData) >= SHORT_MATCH_LENGTH)
+            {
+                memcpy(pData, pMatch, SHORT_MATCH_LENGTH);
+                return;
+            }
+
+            for (size_t i = 0; i < length; i++)
+            {
+                pData[i] = pMatch[i];
+            }
+
+            return;
+        }
+
+        if (offset >= length)
+        {
+            memcpy(pData, pMatch, length);
+            return;
+        }
+
+        if (offset == 1)
+        {
+            memset(pData, *pMatch, length);
+            return;
+        }
+
+        // Overlapping matches repeat a pattern. Copying from its start doubles the available part each time.
+
+        while (length > 0)
+        {
+            size_t count = std::min<size_t>(pData - pMatch, length);
+            memcpy(pData, pMatch, count);
+
+            pData += count;
+            length -= count;
+        }
+    }
+
+private:
+
+    uint8_t* mpBegin;
+    uint8_t* mpEnd;
+    uint8_t* mpData;
+};
+
+// Reverse output fills the buffer from its end, the way the LDDR-based depackers do. Each block ends right below
+// the data decoded so far and matches copy from higher addresses.
+
+class ReverseOutput
+{
+public:
+
+    ReverseOutput(uint8_t* pOutput, size_t outputSize) : mpBegin(pOutput), mpEnd(pOutput + outputSize), mpData(mpEnd) {}
+
+    size_t Size() const { return mpEnd - mpData; }
+    size_t Space() const { return mpData - mpBegin; }
+
+    bool ReadLiteral(BitStream& stream, size_t length)
+    {
+        if (!stream.ReadBytes(mpData - length, length))
+            return false;
+
+        mpData -= length;
+        return true;
+    }
+
+    void CopyMatch(size_t offset, size_t length)
+    {
+        uint8_t* pTop = mpData;
+        uint8_t* pData = pTop - length;
+        const uint8_t* pMatch = pData + offset;
+        mpData = pData;
+
+        if (length <= SHORT_MATCH_LENGTH)
+        {
+            if (offset >= SHORT_MATCH_LENGTH && static_cast<size_t>(pTop - mpBegin) >= SHORT_MATCH_LENGTH)
+            {
+                memcpy(pTop - SHORT_MATCH_LENGTH, pTop - SHORT_MATCH_LENGTH + offset, SHORT_MATCH_LENGTH);
+                return;
+            }
+
+            while (pTop != pData)
+            {
+                pTop--;
+                *pTop = pTop[offset];
+            }
+
+            return;
+        }
+
+        if (offset >= length)
+        {
+            memcpy(pData, pMatch, length);
+            return;
+        }
+
+        if (offset == 1)
+        {
+            memset(pData, *pTop, length);
+            return;
+        }
+
+        // The pattern lies right above the block, so it is copied from the top down. The available part doubles
+        // each time.
+
+        while (pTop != pData)
+        {
+            size_t count = std::min<size_t>(offset, pTop - pData);
+            memcpy(pTop - count, pTop - count + offset, count);
+
+            pTop -= count;
+            offset += count;
+        }
+    }
+
+private:
+
+    uint8_t* mpBegin;
+    uint8_t* mpEnd;
+    uint8_t* mpData;
+};
+
+template<class OutputType>
+static size_t DecodeLZM(BitStream& stream, const Format& format, OutputType& output)
 {
     if (format.Id() != FormatId::LZM)
-        return {};
+        return 0;
 
     stream.ResetForRead();
-    std::vector<uint8_t> data;
 
     while (true)
     {
@@ -23,161 +185,180 @@ std::vector<uint8_t> DecodeLZM(BitStream& stream, const Format& format, uint32_t
         bool isLiteral = (length & 1);
         length = (length >> 1) + format.ExtendLength();
 
+        if (length > output.Space())
+            return OUTPUT_TOO_SMALL;
+
         if (isLiteral)
         {
-            while (length--)
-            {
-                data.emplace_back(stream.ReadByte());
-            }
+            if (!output.ReadLiteral(stream, length))
+                return 0;
         }
         else
         {
             uint16_t offset = stream.ReadByte() + format.ExtendOffset();
 
-            while (length--)
-            {
-                data.emplace_back(data[data.size() - offset]);
-            }
+            if (offset == 0 || offset > output.Size())
+                return 0;
+
+            output.CopyMatch(offset, length);
         }
 
-        if (!format.EndMarker() && data.size() >= inputSize)
+        if (stream.IsReadPastEnd())
+            return 0;
+
+        if (!format.EndMarker() && output.Space() == 0)
             break;
     }
 
-    return data;
+    return output.Size();
 }
 
-std::vector<uint8_t> DecodeEF8(BitStream& stream, const Format& format, uint32_t inputSize)
+template<class OutputType>
+static size_t DecodeEF8(BitStream& stream, const Format& format, OutputType& output)
 {
     if (format.Id() != FormatId::EF8)
-        return {};
+        return 0;
 
     stream.ResetForRead();
-    std::vector<uint8_t> data;
 
     while (true)
     {
-        uint16_t length = DecodeElias(stream);
+        uint32_t length = DecodeElias(stream);
 
         if (format.EndMarker() && length >= 0x100)
             break;
 
         if (stream.ReadBit())
         {
-            while (length--)
-            {
-                data.emplace_back(stream.ReadByte());
-            }
+            if (length > output.Space())
+                return OUTPUT_TOO_SMALL;
+
+            if (!output.ReadLiteral(stream, length))
+                return 0;
         }
         else
         {
             length++;
             uint16_t offset = stream.ReadByte() + format.ExtendOffset();
 
-            while (length--)
-            {
-                data.emplace_back(data[data.size() - offset]);
-            }
+            if (length > output.Space())
+                return OUTPUT_TOO_SMALL;
+
+            if (offset == 0 || offset > output.Size())
+                return 0;
+
+            output.CopyMatch(offset, length);
         }
 
-        if (!format.EndMarker() && data.size() >= inputSize)
+        if (stream.IsReadPastEnd())
+            return 0;
+
+        if (!format.EndMarker() && output.Space() == 0)
             break;
     }
 
-    return data;
+    return output.Size();
 }
 
-std::vector<uint8_t> DecodeBX0(BitStream& stream, const Format& format, uint32_t inputSize)
+template<class OutputType>
+static size_t DecodeBX0(BitStream& stream, const Format& format, OutputType& output)
 {
     if (format.Id() != FormatId::BX0)
-        return {};
+        return 0;
 
     stream.ResetForRead();
-    std::vector<uint8_t> data;
 
     uint16_t repOffset = 0;
     bool wasLiteral = false;
 
     while (true)
     {
-        if (data.empty() ? true : stream.ReadBit())
+        if (output.Size() == 0 ? true : stream.ReadBit())
         {
-            uint16_t length = DecodeElias(stream);
+            uint32_t length = DecodeElias(stream);
+
+            if (length > output.Space())
+                return OUTPUT_TOO_SMALL;
 
             if (wasLiteral)
             {
-                while (length--)
-                {
-                    data.emplace_back(data[data.size() - repOffset]);
-                }
+                if (repOffset == 0 || repOffset > output.Size())
+                    return 0;
+
+                output.CopyMatch(repOffset, length);
             }
             else
             {
-                while (length--)
-                {
-                    data.emplace_back(stream.ReadByte());
-                }
+                if (!output.ReadLiteral(stream, length))
+                    return 0;
             }
 
             wasLiteral = !wasLiteral;
         }
         else
         {
-            uint16_t offset = DecodeElias(stream) - 1;
+            uint32_t offset = DecodeElias(stream) - 1;
 
             if (format.EndMarker() && (offset & 0x80))
                 break;
 
             offset = (offset << 8) | stream.ReadByte();
-            uint16_t length = DecodeEliasWithFlag(stream, offset & 1) + 1;
+            uint32_t length = DecodeEliasWithFlag(stream, offset & 1) + 1;
             offset = (offset >> 1) + format.ExtendOffset();
 
-            while (length--)
-            {
-                data.emplace_back(data[data.size() - offset]);
-            }
+            if (length > output.Space())
+                return OUTPUT_TOO_SMALL;
 
-            repOffset = offset;
+            if (offset == 0 || offset > output.Size())
+                return 0;
+
+            output.CopyMatch(offset, length);
+
+            repOffset = static_cast<uint16_t>(offset);
             wasLiteral = false;
         }
 
-        if (!format.EndMarker() && data.size() >= inputSize)
+        if (stream.IsReadPastEnd())
+            return 0;
+
+        if (!format.EndMarker() && output.Space() == 0)
             break;
     }
 
-    return data;
+    return output.Size();
 }
 
-std::vector<uint8_t> DecodeBX2(BitStream& stream, const Format& format, uint32_t inputSize)
+template<class OutputType>
+static size_t DecodeBX2(BitStream& stream, const Format& format, OutputType& output)
 {
     if (format.Id() != FormatId::BX2)
-        return {};
+        return 0;
 
     stream.ResetForRead();
-    std::vector<uint8_t> data;
 
     uint16_t repOffset = 0;
     bool wasLiteral = false;
 
     while (true)
     {
-        uint16_t length = DecodeElias(stream);
+        uint32_t length = DecodeElias(stream);
 
         if (stream.ReadBit())
         {
+            if (length > output.Space())
+                return OUTPUT_TOO_SMALL;
+
             if (wasLiteral)
             {
-                while (length--)
-                {
-                    data.emplace_back(data[data.size() - repOffset]);
-                }
+                if (repOffset == 0 || repOffset > output.Size())
+                    return 0;
+
+                output.CopyMatch(repOffset, length);
             }
             else
             {
-                while (length--)
-                {
-                    data.emplace_back(stream.ReadByte());
-                }
+                if (!output.ReadLiteral(stream, length))
+                    return 0;
             }
 
             wasLiteral = !wasLiteral;
@@ -190,48 +371,120 @@ std::vector<uint8_t> DecodeBX2(BitStream& stream, const Format& format, uint32_t
             if (format.EndMarker() && offset == 0)
                 break;
 
-            while (length--)
-            {
-                data.emplace_back(data[data.size() - offset]);
-            }
+            if (length > output.Space())
+                return OUTPUT_TOO_SMALL;
+
+            if (offset == 0 || offset > output.Size())
+                return 0;
+
+            output.CopyMatch(offset, length);
 
             repOffset = offset;
             wasLiteral = false;
         }
 
-        if (!format.EndMarker() && data.size() >= inputSize)
+        if (stream.IsReadPastEnd())
+            return 0;
+
+        if (!format.EndMarker() && output.Space() == 0)
             break;
     }
 
-    return data;
+    return output.Size();
 }
 
-std::vector<uint8_t> Decompress(BitStream& stream, const Format& format, uint32_t inputSize)
+template<class OutputType>
+static size_t DecodeStream(BitStream& stream, const Format& format, uint8_t* pOutput, size_t outputSize)
 {
-    std::vector<uint8_t> data;
+    OutputType output(pOutput, outputSize);
 
     switch (format.Id())
     {
         case FormatId::LZM:
-            data = DecodeLZM(stream, format, inputSize);
-            break;
+            return DecodeLZM(stream, format, output);
 
         case FormatId::EF8:
-            data = DecodeEF8(stream, format, inputSize);
-            break;
+            return DecodeEF8(stream, format, output);
 
         case FormatId::BX0:
-            data = DecodeBX0(stream, format, inputSize);
-            break;
+            return DecodeBX0(stream, format, output);
 
         case FormatId::BX2:
-            data = DecodeBX2(stream, format, inputSize);
-            break;
+            return DecodeBX2(stream, format, output);
     }
 
+    return 0;
+}
+
+// Reverse streams are read from their last byte and the data is decoded backwards, so it ends up at the end of
+// the buffer in its original order.
+
+static size_t DecodeStream(BitStream& stream, const Format& format, uint8_t* pOutput, size_t outputSize)
+{
     if (format.Reverse())
+        return DecodeStream<ReverseOutput>(stream, format, pOutput, outputSize);
+
+    return DecodeStream<ForwardOutput>(stream, format, pOutput, outputSize);
+}
+
+size_t Decompress(BitStream& stream, const Format& format, uint8_t* pOutput, size_t outputSize)
+{
+    if (pOutput == nullptr || outputSize == 0)
+        return 0;
+
+    size_t size = DecodeStream(stream, format, pOutput, outputSize);
+    if (size == OUTPUT_TOO_SMALL)
+        return 0;
+
+    if (format.Reverse() && size < outputSize)
     {
-        std::reverse(data.begin(), data.end());
+        memmove(pOutput, pOutput + outputSize - size, size);
+    }
+
+    return size;
+}
+
+size_t Decompress(const uint8_t* pStream, size_t streamSize, const Format& format, uint8_t* pOutput, size_t outputSize)
+{
+    if (pStream == nullptr || streamSize == 0)
+        return 0;
+
+    // As in the encoders, the formats with bits complement them unless the stream is natural.
+
+    BitStream stream(pStream, streamSize, format.Id() != FormatId::LZM && !format.NaturalStream(), format.Reverse());
+
+    return Decompress(stream, format, pOutput, outputSize);
+}
+
+std::vector<uint8_t> Decompress(BitStream& stream, const Format& format, uint32_t inputSize)
+{
+    // Streams with an end marker may be larger than the given size. The buffer then grows until the stream fits
+    // (a corrupt stream reads past its end first).
+
+    std::vector<uint8_t> data(inputSize ? inputSize : std::max<size_t>(stream.Size() * 4, 256));
+
+    while (true)
+    {
+        size_t size = DecodeStream(stream, format, data.data(), data.size());
+
+        if (size != OUTPUT_TOO_SMALL)
+        {
+            if (format.Reverse())
+            {
+                data.erase(data.begin(), data.end() - size);
+            }
+            else
+            {
+                data.resize(size);
+            }
+
+            break;
+        }
+
+        if (!format.EndMarker() || stream.IsReadPastEnd())
+            return {};
+
+        data.resize(data.size() * 2);
     }
 
     return data;
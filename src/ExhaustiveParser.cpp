@@ -2,154 +2,428 @@
 // This code is licensed under the BSD 2-Clause License.
 
 #include "ExhaustiveParser.h"
-#include "PrefixMatcher.h"
+#include <cassert>
+#include <functional>
+#include "WorkerPool.h"
 
-std::vector<ParseStep> ExhaustiveParser::Parse(const uint8_t* pInput, uint32_t inputSize, const Format& format)
+template<class FormatType>
+std::vector<ParseStep> ExhaustiveParser::Parse(const uint8_t* pInput, uint32_t inputSize, const FormatType& format, const MatchFinder& matcher, const ParserOptions& options)
 {
     if (pInput == nullptr || inputSize == 0)
         return {};
 
-    // Precompute all available matches for each input position.
+    std::vector<MatchRange> matches;
+    LiteralCostModel literalModel(format);
 
-    std::vector<Match> matches;
-    PrefixMatcher matcher(pInput, inputSize, format.MinMatchLength(), format.MaxMatchLength(), format.MaxMatchOffset());
+    // The exact parse is bounded by a quick approximate parse. A state whose cost plus a lower bound on the rest
+    // of the input exceeds that bound cannot be part of an optimal parse, so it is not followed any further.
 
-    // Allocate a triangular DP table (row pointers into a contiguous buffer).
+    uint32_t upperBound = UINT32_MAX;
+    std::vector<uint32_t> matchBounds(inputSize + 1), literalBounds(inputSize + 1);
 
-    size_t nodeCount = GetNodeCount(inputSize, format.MaxMatchOffset());
-    std::vector<PathNode> nodeBuffer(nodeCount);
+    if (options.beamWidth == 0)
+    {
+        ParserOptions boundOptions;
+        boundOptions.beamWidth = BOUND_BEAM_WIDTH;
+
+        upperBound = GetParseCost(Parse(pInput, inputSize, format, matcher, boundOptions), format);
+        GetLowerBounds(inputSize, format, matcher, literalModel, matchBounds, literalBounds);
+    }
+
+    // Select the offsets worth tracking at each position. A state after a literal needs its own node if a match
+    // with the same offset starts there. A state after a match needs its own node if a later match within the
+    // literal range can reuse its offset. Rows are gathered back to front so that the next use of each offset
+    // is already known. The approximate parse fills its rows on the fly instead.
+
+    std::vector<PathRow> rows(inputSize + 1);
+    std::vector<size_t> firstNodes(inputSize + 1);
+    std::vector<uint16_t> offsets;
+
+    if (options.beamWidth != 0)
+    {
+        // Rows of the approximate parse have room for the cheapest states after a match and the cheapest states
+        // after a literal (added once the row is final).
+
+        size_t rowCapacity = 2 * options.beamWidth;
+        offsets.resize((inputSize + 1) * rowCapacity);
+
+        for (uint32_t inputPos = 0; inputPos <= inputSize; inputPos++)
+        {
+            firstNodes[inputPos] = inputPos * rowCapacity;
+        }
+    }
+    else
+    {
+        std::vector<uint32_t> nextUsePos(format.MaxMatchOffset() + 1, UINT32_MAX);
+        std::vector<Match> byteMatches, prevByteMatches;
+
+        for (uint32_t inputPos = inputSize + 1; inputPos-- > 0;)
+        {
+            std::swap(byteMatches, prevByteMatches);
+
+            if (inputPos > 0)
+            {
+                matcher.GetByteMatches(prevByteMatches, inputPos - 1);
+            }
+            else
+            {
+                prevByteMatches.clear();
+            }
+
+            // Merge both offset lists (each sorted in ascending order).
+
+            firstNodes[inputPos] = offsets.size();
+            uint32_t maxUsePos = inputPos + format.MaxLiteralLength();
+            auto iByteMatch = byteMatches.begin();
+
+            for (const Match& prevByteMatch: prevByteMatches)
+            {
+                if (nextUsePos[prevByteMatch.offset] > maxUsePos)
+                    continue;
+
+                for (; iByteMatch != byteMatches.end() && iByteMatch->offset < prevByteMatch.offset; iByteMatch++)
+                {
+                    offsets.emplace_back(iByteMatch->offset);
+                }
+
+                if (iByteMatch == byteMatches.end() || iByteMatch->offset != prevByteMatch.offset)
+                {
+                    offsets.emplace_back(prevByteMatch.offset);
+                }
+            }
+
+            for (; iByteMatch != byteMatches.end(); iByteMatch++)
+            {
+                offsets.emplace_back(iByteMatch->offset);
+            }
 
-    std::vector<PathNode*> nodes(inputSize + 1);
-    PathNode* rowPtr = nodeBuffer.data();
+            rows[inputPos].nodeCount = static_cast<uint16_t>(offsets.size() - firstNodes[inputPos]);
+
+            for (const Match& byteMatch: byteMatches)
+            {
+                nextUsePos[byteMatch.offset] = inputPos;
+            }
+        }
+    }
+
+    // Node costs and backtracking steps are kept in separate arrays, so the row scans only touch the costs.
+
+    std::vector<uint32_t> matchCosts(offsets.size(), static_cast<uint32_t>(PathNode::INVALID_COST));
+    std::vector<NodeSteps> steps(offsets.size());
 
     for (uint32_t inputPos = 0; inputPos <= inputSize; inputPos++)
     {
-        nodes[inputPos] = rowPtr;
-        rowPtr += GetRowWidth(inputPos, format.MaxMatchOffset());
+        rows[inputPos].pMatchCosts = matchCosts.data() + firstNodes[inputPos];
+        rows[inputPos].pSteps = steps.data() + firstNodes[inputPos];
+        rows[inputPos].pOffsets = offsets.data() + firstNodes[inputPos];
     }
 
     // Initialize the state and sweep over all coding paths at each input position.
 
-    nodes[0]->costAfterMatch = 0;
-    nodes[0]->literalRowWidth = 1;
+    LiteralSources literalSources;
+    std::vector<LiteralSources> repLiteralSources(format.MaxMatchOffset() + 1);
+
+    rows[0].otherNode.costAfterMatch = 0;
+
+    // Matches at different offsets only meet in the shared nodes, so each task relaxes a slice of the matches
+    // and defers its shared node updates. The deferred updates are applied in task order, which is the order of
+    // the serial sweep. Rows of the approximate parse change their layout while relaxing, so it stays serial.
+
+    WorkerPool workerPool((options.beamWidth != 0) ? 1 : options.threadCount);
+    std::vector<std::vector<OtherMatch>> otherMatches(workerPool.ThreadCount());
+    std::vector<ParserStats> taskStats(workerPool.ThreadCount());
+    std::vector<size_t> taskStarts;
+
+    // The approximate parse pulls the literals for all repeat matches up front, so that only the cheapest states
+    // after a literal are followed by repeat matches. Regular matches of each length are only relaxed at the
+    // lowest offsets (their costs never decrease with the offset).
+
+    std::vector<uint16_t> beamLengths;
+    std::vector<uint32_t> beamCosts;
+    std::vector<uint16_t> beamLiteralLengths;
+    std::vector<uint64_t> beamStates;
+    std::vector<bool> hasRepSources(options.beamWidth != 0 ? repLiteralSources.size() : 0);
+    uint16_t skipLength = (options.beamWidth != 0) ? BEAM_MAX_LENGTH : 0xFFFF;
+
+    auto SelectBeam = [&](PathRow& row, uint32_t inputPos)
+    {
+        LimitMatchLengths(matches, options.beamWidth, beamLengths);
+
+        beamCosts.clear();
+        beamLiteralLengths.clear();
+
+        for (const MatchRange& match: matches)
+        {
+            uint16_t offset = match.offset;
+            uint16_t literalLength = 0;
+            uint32_t cost = PathNode::INVALID_COST;
+
+            if (hasRepSources[offset])
+            {
+                cost = repLiteralSources[offset].FindMinCost(inputPos, offset, literalLength, literalModel);
+            }
+
+            beamCosts.push_back(cost);
+            beamLiteralLengths.push_back(literalLength);
+        }
+
+        LimitRepeatCosts(beamCosts, options.beamWidth, beamStates);
+
+        for (size_t i = 0; i < matches.size(); i++)
+        {
+            if (beamCosts[i] != PathNode::INVALID_COST)
+            {
+                row.AddBeamLiteral(matches[i].offset, beamLiteralLengths[i]);
+            }
+        }
+    };
 
     for (uint32_t inputPos = 0; inputPos < inputSize; inputPos++)
     {
-        size_t matchIndex = matcher.GetMatches(matches, inputPos, true);
+        matcher.GetMatches(matches, inputPos, true);
+        PathRow& row = rows[inputPos];
+
+        // Pull the cheapest literals ending at the current position (only from states that ended with a match).
 
-        // Mark future positions that are reachable by available matches.
+        PathNode& otherNode = row.otherNode;
+        otherNode.costAfterLiteral = literalSources.FindMinCost(inputPos, row.otherLiteralOffset, otherNode.literalLength, literalModel);
 
-        for (const Match& match: matches)
+        // No repeat match can be part of an optimal parse if even the cheapest literal is pruned.
+
+        bool isLiteralPruned = otherNode.costAfterLiteral + literalBounds[inputPos] > upperBound;
+
+        // Make the states that ended with a match available to future literals. All matches that end here have
+        // already been relaxed.
+
+        uint16_t matchOffset = 0;
+        uint32_t matchCost = row.FindMinMatchCost(matchOffset);
+
+        if (matchCost != PathNode::INVALID_COST && matchCost + matchBounds[inputPos] <= upperBound)
         {
-            uint32_t nextPos = inputPos + match.length;
-            nodes[nextPos]->literalRowWidth = GetRowWidth(nextPos, format.MaxMatchOffset());
+            literalSources.Push(inputPos, matchCost, matchOffset, literalModel);
         }
 
-        // Propagate literals (only from states that ended with a match).
+        // Find the minimum cost at the current position and store the backtracking state.
 
-        uint16_t rowWidth = nodes[inputPos]->literalRowWidth;
-        uint16_t maxLength = std::min<uint16_t>(inputSize - inputPos, format.MaxLiteralLength());
+        uint32_t bestCost = row.SelectBacktrackState(matchCost, matchOffset);
+        bool isBestPruned = bestCost + std::min(matchBounds[inputPos], literalBounds[inputPos]) > upperBound;
 
-        for (uint16_t offset = 0; offset < rowWidth; offset++)
+        if (options.beamWidth != 0)
         {
-            uint32_t cost = nodes[inputPos][offset].CostAfterMatch();
-            if (cost == PathNode::INVALID_COST)
-                continue;
+            SelectBeam(row, inputPos);
+        }
 
-            for (uint16_t length = 1; length <= maxLength; length++)
+        // The approximate parse skips from long lengths straight to the longest one.
+
+        auto NextLength = [&](uint16_t length, uint16_t maxLength) -> uint16_t
+        {
+            return (length >= skipLength && length < maxLength) ? maxLength : length + 1;
+        };
+
+        auto RelaxMatches = [&](size_t firstMatch, size_t lastMatch, std::vector<OtherMatch>& deferredMatches, ParserStats& stats)
+        {
+            uint64_t relaxations = 0;
+            uint64_t prunedRelaxations = 0;
+
+            // Offsets of all matches can be followed by a repeat match, so they have their own nodes with literal
+            // states (unless the approximate parse already selected them). Both lists are sorted by offset.
+
+            uint16_t nodeIndex = static_cast<uint16_t>(row.FindNode(matches[firstMatch].offset));
+
+            for (size_t i = firstMatch; i < lastMatch; i++)
             {
-                PathNode& nextNode = nodes[inputPos + length][offset];
-                uint32_t nextCost = cost + format.GetLiteralCost(length);
+                const MatchRange& match = matches[i];
+                uint16_t offset = match.offset;
+                uint32_t cost = PathNode::INVALID_COST;
 
-                if (nextCost < nextNode.costAfterLiteral)
+                if (options.beamWidth != 0)
                 {
-                    nextNode.costAfterLiteral = nextCost;
-                    nextNode.literalLength = length;
+                    cost = beamCosts[i];
                 }
-            }
-        }
+                else if (isLiteralPruned || repLiteralSources[offset].GetCostBound(inputPos, literalModel) + literalBounds[inputPos] > upperBound)
+                {
+                    relaxations += match.maxLength - match.minLength + 1;
+                    prunedRelaxations += match.maxLength - match.minLength + 1;
+                }
+                else
+                {
+                    while (row.pOffsets[nodeIndex] != match.offset)
+                    {
+                        nodeIndex++;
+                    }
 
-        // Propagate repeat matches (only from states that ended with a literal).
+                    cost = repLiteralSources[offset].FindMinCost(inputPos, offset, row.pSteps[nodeIndex].literalLength, literalModel);
+                }
 
-        if (matches.empty())
-            continue;
+                // Propagate repeat matches (only from states that ended with a literal).
 
-        rowWidth = GetRowWidth(inputPos, format.MaxMatchOffset());
+                if (cost != PathNode::INVALID_COST && cost + literalBounds[inputPos] > upperBound)
+                {
+                    relaxations += match.maxLength - match.minLength + 1;
+                    prunedRelaxations += match.maxLength - match.minLength + 1;
+                }
+                else if (cost != PathNode::INVALID_COST)
+                {
+                    for (uint16_t length = match.minLength; length <= match.maxLength; length = NextLength(length, match.maxLength))
+                    {
+                        uint32_t nextCost = cost + format.GetRepMatchCost(length);
+                        relaxations++;
+
+                        if (nextCost + matchBounds[inputPos + length] > upperBound)
+                        {
+                            prunedRelaxations++;
+                            continue;
+                        }
+
+                        if (!rows[inputPos + length].RelaxNodeMatch(offset, nextCost, length, true, options.beamWidth))
+                        {
+                            deferredMatches.push_back({inputPos + length, nextCost, offset, length, true});
+                        }
+                    }
+                }
 
-        for (uint16_t offset = 1; offset < rowWidth; offset++)
-        {
-            uint32_t cost = nodes[inputPos][offset].costAfterLiteral;
-            if (cost == PathNode::INVALID_COST)
-                continue;
+                // Propagate regular matches (prior offset is irrelevant).
 
-            for (const Match& match: matches)
-            {
-                if (match.offset != offset)
-                    continue;
+                uint16_t minLength = std::max(match.minLength, format.MinMatchLength());
 
-                PathNode& nextNode = nodes[inputPos + match.length][offset];
-                uint32_t nextCost = cost + format.GetRepMatchCost(match.length);
+                if (options.beamWidth != 0)
+                {
+                    minLength = std::max(minLength, beamLengths[i]);
+                }
+
+                if (isBestPruned)
+                {
+                    relaxations += std::max(match.maxLength + 1 - minLength, 0);
+                    prunedRelaxations += std::max(match.maxLength + 1 - minLength, 0);
+                    continue;
+                }
 
-                if (nextCost < nextNode.CostAfterMatch())
+                for (uint16_t length = minLength; length <= match.maxLength; length = NextLength(length, match.maxLength))
                 {
-                    nextNode.costAfterMatch = 0x80000000 | nextCost;
-                    nextNode.matchLength = match.length;
+                    uint32_t nextCost = bestCost + format.GetMatchCost(length, offset);
+                    relaxations++;
+
+                    if (nextCost + matchBounds[inputPos + length] > upperBound)
+                    {
+                        prunedRelaxations++;
+                        continue;
+                    }
+
+                    if (!rows[inputPos + length].RelaxNodeMatch(offset, nextCost, length, false, options.beamWidth))
+                    {
+                        deferredMatches.push_back({inputPos + length, nextCost, offset, length, false});
+                    }
                 }
             }
+
+            stats.relaxations += relaxations;
+            stats.prunedRelaxations += prunedRelaxations;
+        };
+
+        // Split the matches into slices of similar work. Small rows are not worth the synchronization.
+
+        size_t totalWork = 0;
+
+        for (const MatchRange& match: matches)
+        {
+            totalWork += match.maxLength - match.minLength + 1;
         }
 
-        // Find the minimum cost at the current position and store the backtracking offset.
+        uint32_t taskCount = std::min<size_t>(workerPool.ThreadCount(), totalWork / MIN_TASK_WORK);
 
-        uint32_t bestCost = PathNode::INVALID_COST;
-        uint16_t bestOffset = 0xFFFF;
+        if (taskCount <= 1)
+        {
+            if (!matches.empty())
+            {
+                RelaxMatches(0, matches.size(), otherMatches[0], taskStats[0]);
+            }
 
-        for (uint16_t offset = 0; offset < rowWidth; offset++)
+            taskCount = 1;
+        }
+        else
         {
-            uint32_t minCost = nodes[inputPos][offset].MinCost();
+            taskStarts.assign(1, 0);
+            size_t work = 0;
 
-            if (minCost < bestCost)
+            for (size_t i = 0; i < matches.size() && taskStarts.size() < taskCount; i++)
             {
-                bestCost = minCost;
-                bestOffset = offset;
+                work += matches[i].maxLength - matches[i].minLength + 1;
+
+                if (work * taskCount >= totalWork * taskStarts.size())
+                {
+                    taskStarts.push_back(i + 1);
+                }
             }
+
+            taskCount = static_cast<uint32_t>(taskStarts.size());
+            taskStarts.push_back(matches.size());
+
+            workerPool.Run(taskCount, [&](uint32_t taskIndex)
+            {
+                if (taskStarts[taskIndex] < taskStarts[taskIndex + 1])
+                {
+                    RelaxMatches(taskStarts[taskIndex], taskStarts[taskIndex + 1], otherMatches[taskIndex], taskStats[taskIndex]);
+                }
+            });
         }
 
-        nodes[inputPos]->backtrackOffset = bestOffset;
+        for (uint32_t taskIndex = 0; taskIndex < taskCount; taskIndex++)
+        {
+            for (const OtherMatch& otherMatch: otherMatches[taskIndex])
+            {
+                rows[otherMatch.inputPos].RelaxOtherMatch(otherMatch.offset, otherMatch.cost, otherMatch.length, otherMatch.isRepeatMatch);
+            }
 
-        // Propagate regular matches (prior offset is irrelevant).
+            otherMatches[taskIndex].clear();
+        }
+
+        // Make the states that ended with a match available to future repeat matches (after the literals
+        // above were pulled).
 
-        for (size_t i = matchIndex; i < matches.size(); i++)
+        for (uint16_t i = 0; i < row.nodeCount; i++)
         {
-            const Match& match = matches[i];
-            PathNode& nextNode = nodes[inputPos + match.length][match.offset];
-            uint32_t nextCost = bestCost + format.GetMatchCost(match.length, match.offset);
+            uint32_t cost = row.pMatchCosts[i] & PathNode::INVALID_COST;
 
-            if (nextCost < nextNode.CostAfterMatch())
+            if (cost != PathNode::INVALID_COST && cost + matchBounds[inputPos] <= upperBound)
             {
-                nextNode.costAfterMatch = nextCost;
-                nextNode.matchLength = match.length;
+                repLiteralSources[row.pOffsets[i]].Push(inputPos, cost, row.pOffsets[i], literalModel);
+
+                if (options.beamWidth != 0)
+                {
+                    hasRepSources[row.pOffsets[i]] = true;
+                }
             }
         }
     }
 
     // Find the best final state at the end of input.
 
-    uint16_t rowWidth = GetRowWidth(inputSize, format.MaxMatchOffset());
-    uint32_t bestCost = PathNode::INVALID_COST;
-    uint16_t bestOffset = 0;
+    PathRow& lastRow = rows[inputSize];
+    lastRow.otherNode.costAfterLiteral = literalSources.FindMinCost(inputSize, lastRow.otherLiteralOffset, lastRow.otherNode.literalLength, literalModel);
+
+    uint16_t matchOffset = 0;
+    uint32_t matchCost = lastRow.FindMinMatchCost(matchOffset);
+    uint32_t finalCost = lastRow.SelectBacktrackState(matchCost, matchOffset);
+    assert(finalCost <= upperBound);
 
-    for (uint16_t offset = 0; offset < rowWidth; offset++)
+    if (options.pStats != nullptr && options.beamWidth == 0)
     {
-        uint32_t minCost = nodes[inputSize][offset].MinCost();
+        ParserStats& stats = *options.pStats;
+        stats = {};
+        stats.upperBound = upperBound;
+        stats.lowerBound = matchBounds[0];
+        stats.cost = finalCost;
 
-        if (minCost < bestCost)
+        for (const ParserStats& threadStats: taskStats)
         {
-            bestCost = minCost;
-            bestOffset = offset;
+            stats.relaxations += threadStats.relaxations;
+            stats.prunedRelaxations += threadStats.prunedRelaxations;
         }
     }
 
-    bool isLiteral = nodes[inputSize][bestOffset].PreferLiteralPath();
+    uint16_t bestOffset = lastRow.backtrackOffset;
+    bool isLiteral = lastRow.backtrackLiteral;
+    bool isRepeatSource = false;
 
     // Backtrack to reconstruct the optimal parse sequence.
 
@@ -157,24 +431,28 @@ std::vector<ParseStep> ExhaustiveParser::Parse(const uint8_t* pInput, uint32_t i
 
     while (inputSize)
     {
-        const PathNode& node = nodes[inputSize][bestOffset];
+        const PathRow& row = rows[inputSize];
 
         if (isLiteral)
         {
+            // Literals followed by a repeat match have their own nodes, otherwise the cheapest literal applies.
+
+            PathNode node = isRepeatSource ? row.GetNode(bestOffset) : row.otherNode;
             parse.emplace_back(node.literalLength, 0);
             inputSize -= node.literalLength;
             isLiteral = false;
         }
         else
         {
+            PathNode node = row.GetNode(bestOffset);
             parse.emplace_back(node.matchLength, bestOffset);
             inputSize -= node.matchLength;
-            isLiteral = node.IsRepeatMatch();
+            isLiteral = isRepeatSource = node.IsRepeatMatch();
 
             if (!isLiteral)
             {
-                bestOffset = nodes[inputSize]->backtrackOffset;
-                isLiteral = nodes[inputSize][bestOffset].PreferLiteralPath();
+                bestOffset = rows[inputSize].backtrackOffset;
+                isLiteral = rows[inputSize].backtrackLiteral;
             }
         }
     }
@@ -183,3 +461,514 @@ std::vector<ParseStep> ExhaustiveParser::Parse(const uint8_t* pInput, uint32_t i
 
     return parse;
 }
+
+size_t ExhaustiveParser::EstimateNodeCount(const uint8_t* pInput, uint32_t inputSize, const Format& format, const ParserOptions& options, uint32_t historySize)
+{
+    // Rows of the approximate parse have a fixed capacity. The exact parse starts with an approximate one.
+
+    uint32_t beamWidth = (options.beamWidth != 0) ? options.beamWidth : BOUND_BEAM_WIDTH;
+    size_t beamNodeCount = (static_cast<size_t>(inputSize) + 1) * 2 * beamWidth;
+
+    if (options.beamWidth != 0)
+        return beamNodeCount;
+
+    // A row of the exact parse only has nodes for the byte matches at its own position and at the position
+    // before it, so each byte match is counted twice. Byte matches are counted over a sliding window of the
+    // byte frequencies.
+
+    const uint8_t* pWindow = pInput - historySize;
+    uint32_t windowSize = format.MaxMatchOffset();
+    uint32_t byteCounts[256] = {};
+    size_t byteMatchCount = 0;
+
+    for (uint32_t windowPos = 0; windowPos < historySize + inputSize; windowPos++)
+    {
+        if (windowPos > windowSize)
+        {
+            byteCounts[pWindow[windowPos - windowSize - 1]]--;
+        }
+
+        if (windowPos >= historySize)
+        {
+            byteMatchCount += byteCounts[pWindow[windowPos]];
+        }
+
+        byteCounts[pWindow[windowPos]]++;
+    }
+
+    return std::max(2 * byteMatchCount, beamNodeCount);
+}
+
+size_t ExhaustiveParser::EstimateMemory(const uint8_t* pInput, uint32_t inputSize, const Format& format, const ParserOptions& options, uint32_t historySize)
+{
+    size_t nodeCount = EstimateNodeCount(pInput, inputSize, format, options, historySize);
+
+    // Each node has an offset, a cost and its backtracking steps.
+    // Each row comes with its first node index and the lower bounds.
+
+    size_t rowSize = sizeof(PathRow) + sizeof(size_t) + 2 * sizeof(uint32_t);
+
+    return nodeCount * (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(NodeSteps)) + (static_cast<size_t>(inputSize) + 1) * rowSize;
+}
+
+template<class FormatType>
+uint32_t ExhaustiveParser::GetParseCost(const std::vector<ParseStep>& parse, const FormatType& format)
+{
+    uint32_t cost = 0;
+    uint16_t repOffset = 0;
+    bool wasLiteral = false;
+
+    for (const ParseStep& parseStep: parse)
+    {
+        if (parseStep.offset)
+        {
+            bool isRepeatMatch = wasLiteral && (parseStep.offset == repOffset);
+            cost += isRepeatMatch ? format.GetRepMatchCost(parseStep.length) : format.GetMatchCost(parseStep.length, parseStep.offset);
+            repOffset = parseStep.offset;
+        }
+        else
+        {
+            cost += format.GetLiteralCost(parseStep.length);
+        }
+
+        wasLiteral = !parseStep.offset;
+    }
+
+    return cost;
+}
+
+template<class FormatType>
+void ExhaustiveParser::GetLowerBounds(uint32_t inputSize, const FormatType& format, const MatchFinder& matcher, const LiteralCostModel& literalModel,
+    std::vector<uint32_t>& matchBounds, std::vector<uint32_t>& literalBounds)
+{
+    // Shortest paths to the end of input in a relaxed coding graph. Regular matches use the lowest offset for
+    // each length. A repeat match after a short literal may use any offset that also matches the byte before
+    // the literal (where the previous match ended), after a longer literal it may use any offset. Each byte
+    // of a longer literal costs as much as in the cheapest literal run. Every real parse maps to a path that
+    // is no more expensive.
+
+    std::vector<MatchRange> matches;
+    std::vector<Match> byteMatches;
+    std::vector<uint32_t> repMatchBounds;
+    std::vector<uint32_t> runBounds(inputSize + 1, 0);
+    std::vector<uint32_t> shortLiteralBounds((inputSize + 1) * BOUND_LITERAL_LENGTH, 0);
+    matchBounds.assign(inputSize + 1, 0);
+    literalBounds.assign(inputSize + 1, 0);
+
+    // Positions that cannot reach the end of input keep an invalid bound (the sums of two bounds still fit).
+
+    for (uint32_t inputPos = inputSize; inputPos-- > 0;)
+    {
+        matcher.GetMatches(matches, inputPos, true);
+
+        // Matches are sorted by offset and all ranges start at the shortest length, so each length is first
+        // covered by its lowest offset. Repeat match bounds are minima over all lengths up to the index.
+
+        uint32_t matchBound = PathNode::INVALID_COST;
+        repMatchBounds.assign(1, static_cast<uint32_t>(PathNode::INVALID_COST));
+
+        for (const MatchRange& match: matches)
+        {
+            for (uint32_t length = static_cast<uint32_t>(repMatchBounds.size()); length <= match.maxLength; length++)
+            {
+                uint32_t restBound = matchBounds[inputPos + length];
+                repMatchBounds.push_back(std::min(repMatchBounds.back(), format.GetRepMatchCost(static_cast<uint16_t>(length)) + restBound));
+
+                if (length >= format.MinMatchLength())
+                {
+                    matchBound = std::min(matchBound, format.GetMatchCost(static_cast<uint16_t>(length), match.offset) + restBound);
+                }
+            }
+        }
+
+        literalBounds[inputPos] = std::min(repMatchBounds.back(), matchBound);
+
+        // Bounds after short literals that end here. Both offset lists are sorted in ascending order.
+
+        for (uint32_t literalLength = 1; literalLength <= BOUND_LITERAL_LENGTH && literalLength <= inputPos; literalLength++)
+        {
+            uint32_t firstPos = inputPos - literalLength;
+            uint32_t maxLength = 0;
+
+            if (firstPos > 0)
+            {
+                matcher.GetByteMatches(byteMatches, firstPos - 1);
+                auto iByteMatch = byteMatches.begin();
+
+                for (const MatchRange& match: matches)
+                {
+                    for (; iByteMatch != byteMatches.end() && iByteMatch->offset < match.offset; iByteMatch++);
+
+                    if (iByteMatch != byteMatches.end() && iByteMatch->offset == match.offset)
+                    {
+                        maxLength = std::max<uint32_t>(maxLength, match.maxLength);
+                    }
+                }
+            }
+
+            shortLiteralBounds[inputPos * BOUND_LITERAL_LENGTH + literalLength - 1] = std::min(repMatchBounds[maxLength], matchBound);
+        }
+
+        // After a match, continue with a regular match, a short literal or a longer literal.
+
+        uint32_t bound = matchBound;
+
+        for (uint32_t literalLength = 1; literalLength <= BOUND_LITERAL_LENGTH && inputPos + literalLength <= inputSize; literalLength++)
+        {
+            uint32_t restBound = shortLiteralBounds[(inputPos + literalLength) * BOUND_LITERAL_LENGTH + literalLength - 1];
+            bound = std::min(bound, format.GetLiteralCost(static_cast<uint16_t>(literalLength)) + restBound);
+        }
+
+        if (inputPos + BOUND_LITERAL_LENGTH < inputSize)
+        {
+            uint32_t runPos = inputPos + BOUND_LITERAL_LENGTH + 1;
+            bound = std::min(bound, literalModel.minBucketCost + literalModel.lengthCost * (BOUND_LITERAL_LENGTH + 1) + runBounds[runPos]);
+        }
+
+        matchBounds[inputPos] = std::min(bound, static_cast<uint32_t>(PathNode::INVALID_COST));
+        runBounds[inputPos] = std::min(literalBounds[inputPos], literalModel.lengthCost + runBounds[inputPos + 1]);
+    }
+}
+
+int32_t ExhaustiveParser::PathRow::FindNode(uint16_t offset) const
+{
+    const uint16_t* pOffset = std::lower_bound(pOffsets, pOffsets + nodeCount, offset);
+
+    if (pOffset == pOffsets + nodeCount || *pOffset != offset)
+        return -1;
+
+    return static_cast<int32_t>(pOffset - pOffsets);
+}
+
+ExhaustiveParser::PathNode ExhaustiveParser::PathRow::GetNode(uint16_t offset) const
+{
+    int32_t nodeIndex = FindNode(offset);
+
+    if (nodeIndex < 0)
+        return otherNode;
+
+    PathNode node;
+    node.costAfterMatch = pMatchCosts[nodeIndex];
+    node.literalLength = pSteps[nodeIndex].literalLength;
+    node.matchLength = pSteps[nodeIndex].matchLength;
+
+    return node;
+}
+
+bool ExhaustiveParser::PathRow::RelaxNodeMatch(uint16_t offset, uint32_t cost, uint16_t length, bool isRepeatMatch, uint32_t beamWidth)
+{
+    int32_t nodeIndex = FindNode(offset);
+
+    if (nodeIndex < 0)
+        return beamWidth != 0 && InsertBeamNode(offset, cost, length, isRepeatMatch, beamWidth);
+
+    if (cost < (pMatchCosts[nodeIndex] & PathNode::INVALID_COST))
+    {
+        pMatchCosts[nodeIndex] = (isRepeatMatch ? 0x80000000 : 0) | cost;
+        pSteps[nodeIndex].matchLength = length;
+    }
+
+    return true;
+}
+
+bool ExhaustiveParser::PathRow::InsertBeamNode(uint16_t offset, uint32_t cost, uint16_t length, bool isRepeatMatch, uint32_t beamWidth)
+{
+    // An offset that already lives in the shared node at a lower cost must not get a node of its own, since
+    // backtracking prefers own nodes.
+
+    if (offset == otherMatchOffset && otherNode.CostAfterMatch() <= cost)
+        return false;
+
+    // A full row replaces its most expensive node (higher offsets lose ties), which moves to the shared node.
+
+    if (nodeCount == beamWidth)
+    {
+        uint16_t lastIndex = 0;
+
+        for (uint16_t i = 1; i < nodeCount; i++)
+        {
+            if ((pMatchCosts[i] & PathNode::INVALID_COST) >= (pMatchCosts[lastIndex] & PathNode::INVALID_COST))
+            {
+                lastIndex = i;
+            }
+        }
+
+        uint32_t lastCost = pMatchCosts[lastIndex] & PathNode::INVALID_COST;
+
+        if (cost >= lastCost)
+            return false;
+
+        RelaxOtherMatch(pOffsets[lastIndex], lastCost, pSteps[lastIndex].matchLength, pMatchCosts[lastIndex] & 0x80000000);
+        nodeCount--;
+
+        for (uint16_t i = lastIndex; i < nodeCount; i++)
+        {
+            pMatchCosts[i] = pMatchCosts[i + 1];
+            pSteps[i] = pSteps[i + 1];
+            pOffsets[i] = pOffsets[i + 1];
+        }
+    }
+
+    uint16_t nodeIndex = InsertNode(offset);
+    pMatchCosts[nodeIndex] = (isRepeatMatch ? 0x80000000 : 0) | cost;
+    pSteps[nodeIndex].matchLength = length;
+
+    return true;
+}
+
+void ExhaustiveParser::PathRow::AddBeamLiteral(uint16_t offset, uint16_t literalLength)
+{
+    int32_t nodeIndex = FindNode(offset);
+
+    if (nodeIndex < 0)
+    {
+        nodeIndex = InsertNode(offset);
+
+        // Backtracking looks up the state after a match at this offset in the new node, so it takes over the
+        // state from the shared node.
+
+        if (offset == otherMatchOffset && otherNode.CostAfterMatch() != PathNode::INVALID_COST)
+        {
+            pMatchCosts[nodeIndex] = otherNode.costAfterMatch;
+            pSteps[nodeIndex].matchLength = otherNode.matchLength;
+        }
+    }
+
+    pSteps[nodeIndex].literalLength = literalLength;
+}
+
+uint16_t ExhaustiveParser::PathRow::InsertNode(uint16_t offset)
+{
+    // Keep the nodes sorted by offset. The new node has no states yet.
+
+    uint16_t nodeIndex = static_cast<uint16_t>(std::lower_bound(pOffsets, pOffsets + nodeCount, offset) - pOffsets);
+
+    for (uint16_t i = nodeCount; i > nodeIndex; i--)
+    {
+        pMatchCosts[i] = pMatchCosts[i - 1];
+        pSteps[i] = pSteps[i - 1];
+        pOffsets[i] = pOffsets[i - 1];
+    }
+
+    pMatchCosts[nodeIndex] = PathNode::INVALID_COST;
+    pSteps[nodeIndex] = NodeSteps();
+    pOffsets[nodeIndex] = offset;
+    nodeCount++;
+
+    return nodeIndex;
+}
+
+void ExhaustiveParser::PathRow::RelaxOtherMatch(uint16_t offset, uint32_t cost, uint16_t length, bool isRepeatMatch)
+{
+    if (cost < otherNode.CostAfterMatch() || (cost == otherNode.CostAfterMatch() && offset < otherMatchOffset))
+    {
+        otherNode.costAfterMatch = (isRepeatMatch ? 0x80000000 : 0) | cost;
+        otherNode.matchLength = length;
+        otherMatchOffset = offset;
+    }
+}
+
+uint32_t ExhaustiveParser::PathRow::FindMinMatchCost(uint16_t& offset) const
+{
+    // Ties are resolved in favor of lower offsets, as if all offsets had their own nodes.
+
+    uint32_t minCost = otherNode.CostAfterMatch();
+    offset = otherMatchOffset;
+
+    if (nodeCount == 0)
+        return minCost;
+
+    // Find the minimum first (a plain reduction the compiler can vectorize), then the lowest offset with that
+    // cost. Costs are below 2^31 without the repeat flag, so the signed minimum is safe.
+
+    int32_t nodeMinCost = PathNode::INVALID_COST;
+
+    for (uint16_t i = 0; i < nodeCount; i++)
+    {
+        nodeMinCost = std::min(nodeMinCost, static_cast<int32_t>(pMatchCosts[i] & PathNode::INVALID_COST));
+    }
+
+    if (static_cast<uint32_t>(nodeMinCost) > minCost)
+        return minCost;
+
+    uint16_t i = 0;
+    while ((pMatchCosts[i] & PathNode::INVALID_COST) != static_cast<uint32_t>(nodeMinCost))
+    {
+        i++;
+    }
+
+    if (static_cast<uint32_t>(nodeMinCost) < minCost || pOffsets[i] < offset)
+    {
+        minCost = nodeMinCost;
+        offset = pOffsets[i];
+    }
+
+    return minCost;
+}
+
+uint32_t ExhaustiveParser::PathRow::SelectBacktrackState(uint32_t matchCost, uint16_t matchOffset)
+{
+    // Literals win ties at the same offset.
+
+    uint32_t literalCost = otherNode.costAfterLiteral;
+    backtrackLiteral = (literalCost < matchCost) || (literalCost == matchCost && otherLiteralOffset <= matchOffset);
+    backtrackOffset = backtrackLiteral ? otherLiteralOffset : matchOffset;
+
+    return std::min(literalCost, matchCost);
+}
+
+void ExhaustiveParser::LimitMatchLengths(const std::vector<MatchRange>& matches, uint32_t beamWidth, std::vector<uint16_t>& minLengths)
+{
+    // All ranges start at the shortest length, so a length is only covered by the lowest offsets until the
+    // number of longer ranges seen so far reaches the beam width. A min-heap keeps the longest of these ranges.
+
+    std::vector<uint16_t> maxLengths;
+    minLengths.clear();
+
+    for (const MatchRange& match: matches)
+    {
+        uint32_t minLength = (maxLengths.size() < beamWidth) ? 0 : std::min(maxLengths.front() + 1, 0xFFFF);
+        minLengths.push_back(static_cast<uint16_t>(minLength));
+
+        if (maxLengths.size() < beamWidth)
+        {
+            maxLengths.push_back(match.maxLength);
+            std::push_heap(maxLengths.begin(), maxLengths.end(), std::greater<uint16_t>());
+        }
+        else if (match.maxLength > maxLengths.front())
+        {
+            std::pop_heap(maxLengths.begin(), maxLengths.end(), std::greater<uint16_t>());
+            maxLengths.back() = match.maxLength;
+            std::push_heap(maxLengths.begin(), maxLengths.end(), std::greater<uint16_t>());
+        }
+    }
+}
+
+void ExhaustiveParser::LimitRepeatCosts(std::vector<uint32_t>& costs, uint32_t beamWidth, std::vector<uint64_t>& beamStates)
+{
+    // Drop all but the cheapest states, lower offsets (earlier matches) win ties.
+
+    beamStates.clear();
+
+    for (size_t i = 0; i < costs.size(); i++)
+    {
+        if (costs[i] != PathNode::INVALID_COST)
+        {
+            beamStates.push_back((static_cast<uint64_t>(costs[i]) << 32) | i);
+        }
+    }
+
+    if (beamStates.size() <= beamWidth)
+        return;
+
+    std::nth_element(beamStates.begin(), beamStates.begin() + beamWidth, beamStates.end());
+
+    for (auto iState = beamStates.begin() + beamWidth; iState != beamStates.end(); iState++)
+    {
+        costs[static_cast<uint32_t>(*iState)] = PathNode::INVALID_COST;
+    }
+}
+
+ExhaustiveParser::LiteralCostModel::LiteralCostModel(const Format& format)
+{
+    maxLength = format.MaxLiteralLength();
+    lengthCost = format.GetLiteralCost(3) - format.GetLiteralCost(2);
+
+    for (uint32_t bucket = 0; bucket < BUCKET_COUNT; bucket++)
+    {
+        uint32_t length = 1 << bucket;
+        bucketCosts[bucket] = (length <= maxLength) ? format.GetLiteralCost(length) - lengthCost * length : 0;
+    }
+
+    minBucketCost = bucketCosts[0];
+
+    for (uint32_t bucket = 1; bucket < BUCKET_COUNT && (1u << bucket) <= maxLength; bucket++)
+    {
+        minBucketCost = std::min(minBucketCost, bucketCosts[bucket]);
+    }
+
+    for (uint32_t length = 1; length <= maxLength; length++)
+    {
+        uint32_t bucket = 0;
+        while (length >> (bucket + 1))
+        {
+            bucket++;
+        }
+
+        assert(format.GetLiteralCost(length) == lengthCost * length + bucketCosts[bucket]);
+    }
+}
+
+void ExhaustiveParser::LiteralSources::Push(uint32_t inputPos, uint32_t cost, uint16_t offset, const LiteralCostModel& model)
+{
+    int32_t baseCost = cost - model.lengthCost * inputPos;
+
+    while (!mSources.empty())
+    {
+        const Source& source = mSources.back();
+        if (source.baseCost < baseCost || (source.baseCost == baseCost && source.offset <= offset))
+            break;
+
+        mSources.pop_back();
+    }
+
+    mValidCount = std::min(mValidCount, mSources.size());
+    mSources.push_back({inputPos, baseCost, offset});
+}
+
+uint32_t ExhaustiveParser::LiteralSources::FindMinCost(uint32_t inputPos, uint16_t& offset, uint16_t& length, const LiteralCostModel& model)
+{
+    // Longer literals (earlier sources) win ties at the same offset.
+
+    uint32_t minCost = PathNode::INVALID_COST;
+
+    if (mSources.empty())
+        return minCost;
+
+    uint32_t maxLength = std::min<uint32_t>(inputPos, model.maxLength);
+
+    for (uint32_t bucket = 0; bucket < LiteralCostModel::BUCKET_COUNT && (1u << bucket) <= maxLength; bucket++)
+    {
+        uint32_t firstPos = inputPos - std::min<uint32_t>((2u << bucket) - 1, maxLength);
+        uint32_t lastPos = inputPos - (1u << bucket);
+
+        // Cursors only move forward, but sources that were dropped since the last query must be revisited.
+
+        size_t& cursor = mCursors[bucket];
+        cursor = std::min(cursor, mValidCount);
+
+        while (cursor < mSources.size() && mSources[cursor].inputPos < firstPos)
+        {
+            cursor++;
+        }
+
+        if (cursor == mSources.size() || mSources[cursor].inputPos > lastPos)
+            continue;
+
+        const Source& source = mSources[cursor];
+        uint32_t cost = source.baseCost + model.lengthCost * inputPos + model.bucketCosts[bucket];
+
+        if (cost < minCost || (cost == minCost && source.offset <= offset))
+        {
+            minCost = cost;
+            offset = source.offset;
+            length = inputPos - source.inputPos;
+        }
+    }
+
+    mValidCount = mSources.size();
+    return minCost;
+}
+
+uint32_t ExhaustiveParser::LiteralSources::GetCostBound(uint32_t inputPos, const LiteralCostModel& model) const
+{
+    // The first source is the cheapest one, even if it is too far away.
+
+    if (mSources.empty())
+        return PathNode::INVALID_COST;
+
+    return mSources.front().baseCost + model.lengthCost * inputPos + model.minBucketCost;
+}
+
+template std::vector<ParseStep> ExhaustiveParser::Parse(const uint8_t* pInput, uint32_t inputSize, const FormatBX0& format, const MatchFinder& matcher, const ParserOptions& options);
+template std::vector<ParseStep> ExhaustiveParser::Parse(const uint8_t* pInput, uint32_t inputSize, const FormatBX2& format, const MatchFinder& matcher, const ParserOptions& options);
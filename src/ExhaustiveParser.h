@@ -5,47 +5,168 @@
 #include <vector>
 #include "CommonTypes.h"
 #include "Formats.h"
+#include "MatchFinder.h"
 
 class ExhaustiveParser
 {
 public:
 
-    static std::vector<ParseStep> Parse(const uint8_t* pInput, uint32_t inputSize, const Format& format);
+    // Only instantiated for BX0 and BX2.
+
+    template<class FormatType>
+    static std::vector<ParseStep> Parse(const uint8_t* pInput, uint32_t inputSize, const FormatType& format, const MatchFinder& matcher, const ParserOptions& options = {});
     ExhaustiveParser() = delete;
 
-private:
+    // Returns an upper bound on the number of path nodes of the parse. It only counts the byte matches, which
+    // takes a single pass over the input, so it can be checked before a matcher is built. The history precedes
+    // the input as with MatchFinder::Create.
 
-    static uint16_t GetRowWidth(uint32_t inputPos, uint16_t maxOffset)
-    {
-        return 1 + std::min<uint16_t>(inputPos - (inputPos > 0), maxOffset);
-    }
+    static size_t EstimateNodeCount(const uint8_t* pInput, uint32_t inputSize, const Format& format, const ParserOptions& options = {}, uint32_t historySize = 0);
 
-    static size_t GetNodeCount(uint32_t inputSize, uint16_t maxOffset)
-    {
-        maxOffset = std::min<uint16_t>(maxOffset, inputSize - 1);
-        return (maxOffset + 1) * inputSize - ((maxOffset + 1) * maxOffset >> 1) + 1;
-    }
+    // Returns an estimate of the memory taken by the path nodes and rows of the parse, which dominate its memory
+    // use.
+
+    static size_t EstimateMemory(const uint8_t* pInput, uint32_t inputSize, const Format& format, const ParserOptions& options = {}, uint32_t historySize = 0);
+
+private:
 
     struct PathNode
     {
         static constexpr uint32_t INVALID_COST = 0x7FFFFFFF;
 
         uint32_t CostAfterMatch() const { return costAfterMatch & INVALID_COST; }
-        uint32_t MinCost() const { return std::min(costAfterLiteral, CostAfterMatch()); }
         bool IsRepeatMatch() const { return costAfterMatch & 0x80000000; }
-        bool PreferLiteralPath() const { return costAfterLiteral <= CostAfterMatch(); }
 
         uint32_t costAfterLiteral = INVALID_COST;
         uint32_t costAfterMatch = INVALID_COST;
         uint16_t literalLength = 0;
+        uint16_t matchLength = 0;
+    };
+
+    // Lengths of the last literal and match that reach a node (only needed for backtracking).
+
+    struct NodeSteps
+    {
+        uint16_t literalLength = 0;
+        uint16_t matchLength = 0;
+    };
+
+    // A row only keeps nodes for offsets that can still be reused by a repeat match. The remaining match
+    // states at the same input position are collapsed into a single node that remembers the cheapest offset.
+    // The same node also holds the cheapest literal state over all offsets.
+
+    struct PathRow
+    {
+        int32_t FindNode(uint16_t offset) const;
+        PathNode GetNode(uint16_t offset) const;
+
+        bool RelaxNodeMatch(uint16_t offset, uint32_t cost, uint16_t length, bool isRepeatMatch, uint32_t beamWidth);
+        void RelaxOtherMatch(uint16_t offset, uint32_t cost, uint16_t length, bool isRepeatMatch);
+        uint32_t FindMinMatchCost(uint16_t& offset) const;
+        uint32_t SelectBacktrackState(uint32_t matchCost, uint16_t matchOffset);
+
+        // Rows of the approximate parse start empty and keep the cheapest states after a match.
+
+        bool InsertBeamNode(uint16_t offset, uint32_t cost, uint16_t length, bool isRepeatMatch, uint32_t beamWidth);
+        void AddBeamLiteral(uint16_t offset, uint16_t literalLength);
+        uint16_t InsertNode(uint16_t offset);
+
+        // Own nodes are split into costs after a match (with the repeat flag) and backtracking steps. Their
+        // costs after a literal are only needed while relaxing repeat matches, so they are not stored.
+
+        uint32_t* pMatchCosts = nullptr;
+        NodeSteps* pSteps = nullptr;
+        uint16_t* pOffsets = nullptr;
+        uint16_t nodeCount = 0;
+
+        PathNode otherNode;
+        uint16_t otherLiteralOffset = 0;
+        uint16_t otherMatchOffset = 0;
+
+        uint16_t backtrackOffset = 0;
+        bool backtrackLiteral = false;
+    };
+
+    // A match relaxation that targets the shared node of a row.
+
+    struct OtherMatch
+    {
+        uint32_t inputPos;
+        uint32_t cost;
+        uint16_t offset;
+        uint16_t length;
+        bool isRepeatMatch;
+    };
+
+    // Minimum number of match lengths per task in the parallel relaxation.
+
+    static constexpr size_t MIN_TASK_WORK = 4096;
+
+    // Longer matches are only relaxed at their maximum length in the approximate parse.
+
+    static constexpr uint16_t BEAM_MAX_LENGTH = 64;
+
+    // Beam width of the approximate parse that bounds the cost of the exact parse.
+
+    static constexpr uint32_t BOUND_BEAM_WIDTH = 4;
+
+    // Longest literal after which the lower bound only allows repeat matches at plausible offsets.
+
+    static constexpr uint32_t BOUND_LITERAL_LENGTH = 4;
+
+    static void LimitMatchLengths(const std::vector<MatchRange>& matches, uint32_t beamWidth, std::vector<uint16_t>& minLengths);
+    static void LimitRepeatCosts(std::vector<uint32_t>& costs, uint32_t beamWidth, std::vector<uint64_t>& beamStates);
+
+    // The literal cost grows linearly within each power-of-two length bucket (the Elias-Gamma length prefix
+    // only changes at powers of two).
+
+    struct LiteralCostModel
+    {
+        static constexpr uint32_t BUCKET_COUNT = 16;
+
+        LiteralCostModel(const Format& format);
+
+        int32_t lengthCost;
+        int32_t bucketCosts[BUCKET_COUNT];
+        int32_t minBucketCost;
+        uint16_t maxLength;
+    };
+
+    // Candidate origins of a literal run (states that ended with a match), ordered by input position. A source
+    // is dropped as soon as a later source becomes cheaper, since the later one yields a shorter literal for
+    // any future position. The remaining sources grow in cost, so the first source of each length bucket is
+    // the cheapest one in that bucket.
+
+    class LiteralSources
+    {
+    public:
 
-        union
+        void Push(uint32_t inputPos, uint32_t cost, uint16_t offset, const LiteralCostModel& model);
+        uint32_t FindMinCost(uint32_t inputPos, uint16_t& offset, uint16_t& length, const LiteralCostModel& model);
+        uint32_t GetCostBound(uint32_t inputPos, const LiteralCostModel& model) const;
+
+    private:
+
+        struct Source
         {
-            uint16_t matchLength = 0;
-            uint16_t literalRowWidth;
-            uint16_t backtrackOffset;
+            uint32_t inputPos;
+            int32_t baseCost;
+            uint16_t offset;
         };
+
+        std::vector<Source> mSources;
+        size_t mCursors[LiteralCostModel::BUCKET_COUNT] = {};
+        size_t mValidCount = 0;
     };
+
+    template<class FormatType>
+    static uint32_t GetParseCost(const std::vector<ParseStep>& parse, const FormatType& format);
+
+    // Lower bounds on the cost of the rest of the input after a match and after a literal.
+
+    template<class FormatType>
+    static void GetLowerBounds(uint32_t inputSize, const FormatType& format, const MatchFinder& matcher, const LiteralCostModel& literalModel,
+        std::vector<uint32_t>& matchBounds, std::vector<uint32_t>& literalBounds);
 };
 
 #endif // EXHAUSTIVE_PARSER_H
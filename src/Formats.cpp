@@ -4,26 +4,14 @@
 #include "Formats.h"
 #include "UniversalCodes.h"
 
-uint32_t Format::mEliasCosts[65536] = {0};
-
 Format::Format(const FormatOptions& options):
     mReverse(options.reverse),
     mEndMarker(options.endMarker),
     mExtendOffset(options.extendOffset),
     mExtendLength(options.extendLength),
-    mNaturalStream(options.naturalStream)
+    mNaturalStream(options.naturalStream),
+    mEliasCosts(GetEliasCostTable())
 {
-    // Initialize the Elias-Gamma cost lookup table (index 0 used as sentinel).
-
-    if (mEliasCosts[0] == 0)
-    {
-        mEliasCosts[0] = 0xFFFFFFFF;
-
-        for (uint32_t i = 1; i < 65536; i++)
-        {
-            mEliasCosts[i] = GetEliasCost(i);
-        }
-    }
 }
 
 std::unique_ptr<Format> Format::Create(const FormatOptions& options)
@@ -58,21 +46,6 @@ FormatLZM::FormatLZM(const FormatOptions& options): Format{options}
     mMaxMatchOffset = 255 + options.extendOffset;
 }
 
-uint32_t FormatLZM::GetLiteralCost(uint16_t length) const
-{
-    return 8 + (length << 3);
-}
-
-uint32_t FormatLZM::GetMatchCost(uint16_t length, uint16_t offset) const
-{
-    return 8 + 8;
-}
-
-uint32_t FormatLZM::GetRepMatchCost(uint16_t length) const
-{
-    return 0xFFFFFFFF;
-}
-
 // EF8 format.
 
 FormatEF8::FormatEF8(const FormatOptions& options): Format{options}
@@ -88,21 +61,6 @@ FormatEF8::FormatEF8(const FormatOptions& options): Format{options}
     mMaxMatchOffset = 255 + options.extendOffset;
 }
 
-uint32_t FormatEF8::GetLiteralCost(uint16_t length) const
-{
-    return mEliasCosts[length] + 1 + (length << 3);
-}
-
-uint32_t FormatEF8::GetMatchCost(uint16_t length, uint16_t offset) const
-{
-    return mEliasCosts[length - 1] + 1 + 8;
-}
-
-uint32_t FormatEF8::GetRepMatchCost(uint16_t length) const
-{
-    return 0xFFFFFFFF;
-}
-
 // BX0 format.
 
 FormatBX0::FormatBX0(const FormatOptions& options): Format{options}
@@ -118,22 +76,6 @@ FormatBX0::FormatBX0(const FormatOptions& options): Format{options}
     mMaxMatchOffset = 0x3FFF + options.extendOffset;
 }
 
-uint32_t FormatBX0::GetLiteralCost(uint16_t length) const
-{
-    return 1 + mEliasCosts[length] + (length << 3);
-}
-
-uint32_t FormatBX0::GetMatchCost(uint16_t length, uint16_t offset) const
-{
-    uint16_t eliasPart = GetEliasPart(offset - mExtendOffset);
-    return 1 + mEliasCosts[eliasPart] + 7 + mEliasCosts[length - 1];
-}
-
-uint32_t FormatBX0::GetRepMatchCost(uint16_t length) const
-{
-    return 1 + mEliasCosts[length];
-}
-
 // BX2 format.
 
 FormatBX2::FormatBX2(const FormatOptions& options): Format{options}
@@ -148,18 +90,3 @@ FormatBX2::FormatBX2(const FormatOptions& options): Format{options}
     mMaxMatchLength = 0xFFFF;
     mMaxMatchOffset = 255;
 }
-
-uint32_t FormatBX2::GetLiteralCost(uint16_t length) const
-{
-    return mEliasCosts[length] + 1 + (length << 3);
-}
-
-uint32_t FormatBX2::GetMatchCost(uint16_t length, uint16_t offset) const
-{
-    return mEliasCosts[length - 1] + 1 + 8;
-}
-
-uint32_t FormatBX2::GetRepMatchCost(uint16_t length) const
-{
-    return mEliasCosts[length] + 1;
-}
@@ -81,54 +81,63 @@ protected:
     uint16_t mMaxMatchLength;
     uint16_t mMaxMatchOffset;
 
-    // Precomputed Elias-Gamma cost table for values 1..65535.
+    // Precomputed Elias-Gamma cost table for values 1..65535 (shared by all formats).
 
-    static uint32_t mEliasCosts[65536];
+    const uint32_t* mEliasCosts;
 };
 
-class FormatLZM: public Format
+// The formats are final and define their costs inline, so the parsers can be instantiated for each format and
+// call the cost functions directly.
+
+class FormatLZM final: public Format
 {
     friend class Format;
     FormatLZM(const FormatOptions& options);
 
-    uint32_t GetLiteralCost(uint16_t length) const override;
-    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override;
-    uint32_t GetRepMatchCost(uint16_t length) const override;
+public:
+
+    uint32_t GetLiteralCost(uint16_t length) const override { return 8 + (length << 3); }
+    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override { return 8 + 8; }
+    uint32_t GetRepMatchCost(uint16_t length) const override { return 0xFFFFFFFF; }
 };
 
-class FormatEF8: public Format
+class FormatEF8 final: public Format
 {
     friend class Format;
     FormatEF8(const FormatOptions& options);
 
-    uint32_t GetLiteralCost(uint16_t length) const override;
-    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override;
-    uint32_t GetRepMatchCost(uint16_t length) const override;
+public:
+
+    uint32_t GetLiteralCost(uint16_t length) const override { return mEliasCosts[length] + 1 + (length << 3); }
+    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override { return mEliasCosts[length - 1] + 1 + 8; }
+    uint32_t GetRepMatchCost(uint16_t length) const override { return 0xFFFFFFFF; }
 };
 
-class FormatBX0: public Format
+class FormatBX0 final: public Format
 {
     friend class Format;
     FormatBX0(const FormatOptions& options);
 
-    uint32_t GetLiteralCost(uint16_t length) const override;
-    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override;
-    uint32_t GetRepMatchCost(uint16_t length) const override;
-
 public:
 
+    uint32_t GetLiteralCost(uint16_t length) const override { return 1 + mEliasCosts[length] + (length << 3); }
+    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override { return 1 + mEliasCosts[GetEliasPart(offset - mExtendOffset)] + 7 + mEliasCosts[length - 1]; }
+    uint32_t GetRepMatchCost(uint16_t length) const override { return 1 + mEliasCosts[length]; }
+
     static uint8_t GetRawPart(uint16_t offset) { return offset & 127; }
     static uint16_t GetEliasPart(uint16_t offset) { return (offset >> 7) + 1; }
 };
 
-class FormatBX2: public Format
+class FormatBX2 final: public Format
 {
     friend class Format;
     FormatBX2(const FormatOptions& options);
 
-    uint32_t GetLiteralCost(uint16_t length) const override;
-    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override;
-    uint32_t GetRepMatchCost(uint16_t length) const override;
+public:
+
+    uint32_t GetLiteralCost(uint16_t length) const override { return mEliasCosts[length] + 1 + (length << 3); }
+    uint32_t GetMatchCost(uint16_t length, uint16_t offset) const override { return mEliasCosts[length - 1] + 1 + 8; }
+    uint32_t GetRepMatchCost(uint16_t length) const override { return mEliasCosts[length] + 1; }
 };
 
 #endif // FORMATS_H
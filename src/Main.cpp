@@ -4,11 +4,29 @@
 //#define VERIFY
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
+#include <exception>
 #include <fstream>
 #include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include "Compression.h"
+#include "WorkerPool.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 enum ErrorId
 {
@@ -17,8 +35,15 @@ enum ErrorId
     OutputFileError,
     FileEmpty,
     FileTooBig,
+    BlockTooBig,
+    StreamNotSupported,
+    BatchNotSupported,
+    BatchIncomplete,
+    JobsFailed,
     CompressionFailed,
-    OutOfMemory
+    OutOfMemory,
+    UnexpectedError,
+    VerificationFailed
 };
 
 enum WarningId
@@ -28,58 +53,105 @@ enum WarningId
     NoSizeGain
 };
 
+// Batch jobs run concurrently, each thread prefixes its messages with the file it is working on.
+
+std::mutex printMutex;
+thread_local const char* pJobName = nullptr;
+
 void PrintError(ErrorId error, const char* pString = nullptr)
 {
-    printf("Error: ");
+    std::lock_guard<std::mutex> lock(printMutex);
+
+    fprintf(stderr, "Error: ");
+
+    if (pJobName != nullptr)
+    {
+        fprintf(stderr, "%s: ", pJobName);
+    }
 
     switch (error)
     {
         case ErrorId::InvalidParam:
-            printf("Invalid parameter %s.\n", pString);
+            fprintf(stderr, "Invalid parameter %s.\n", pString);
             break;
 
         case ErrorId::InputFileError:
-            printf("Unable to open the input file.\n");
+            fprintf(stderr, "Unable to open the input file.\n");
             break;
 
         case ErrorId::OutputFileError:
-            printf("Unable to create the output file.\n");
+            fprintf(stderr, "Unable to create the output file.\n");
             break;
 
         case ErrorId::FileEmpty:
-            printf("The input file is empty.\n");
+            fprintf(stderr, "The input file is empty.\n");
             break;
 
         case ErrorId::FileTooBig:
-            printf("The input file is too large.\n");
+            fprintf(stderr, "The input file is too large.\n");
+            break;
+
+        case ErrorId::BlockTooBig:
+            fprintf(stderr, "The block size is too large for this format.\n");
+            break;
+
+        case ErrorId::StreamNotSupported:
+            fprintf(stderr, "Option -c is only supported by LZM and EF8 without -r.\n");
+            break;
+
+        case ErrorId::BatchNotSupported:
+            fprintf(stderr, "Options -c, -auto, -g and -v are not supported with -batch.\n");
+            break;
+
+        case ErrorId::BatchIncomplete:
+            fprintf(stderr, "The input file %s has no output file.\n", pString);
+            break;
+
+        case ErrorId::JobsFailed:
+            fprintf(stderr, "%s batch jobs failed.\n", pString);
             break;
 
         case ErrorId::CompressionFailed:
-            printf("Compression failed.\n");
+            fprintf(stderr, "Compression failed.\n");
             break;
 
         case ErrorId::OutOfMemory:
-            printf("Out of memory.\n");
+            fprintf(stderr, "Out of memory.\n");
+            break;
+
+        case ErrorId::UnexpectedError:
+            fprintf(stderr, "Unexpected error (%s).\n", pString);
+            break;
+
+        case ErrorId::VerificationFailed:
+            fprintf(stderr, "Stream verification failed.\n");
             break;
     }
 }
 
 void PrintWarning(WarningId warning)
 {
-    printf("Warning: ");
+    std::lock_guard<std::mutex> lock(printMutex);
+
+    fprintf(stderr, "Warning: ");
+
+    if (pJobName != nullptr)
+    {
+        fprintf(stderr, "%s: ", pJobName);
+    }
 
     switch (warning)
     {
         case WarningId::ExtendOffset:
-            printf("Option -o is not supported by this format and will be ignored.\n");
+            fprintf(stderr, "Option -o is not supported by this format and will be ignored.\n");
             break;
 
         case WarningId::ExtendLength:
-            printf("Option -l is not supported by this format and will be ignored.\n");
+            fprintf(stderr, "Option -l is not supported by this format and will be ignored.\n");
             break;
 
         case WarningId::NoSizeGain:
-            printf("No size gain after compression.\n");
+            fprintf(stderr, "No size gain after compression.\n");
             break;
     }
 }
@@ -97,6 +169,33 @@ void ValidateOptions(FormatOptions options, const Format& format)
     }
 }
 
+bool ParseCount(const char* pString, uint32_t& value, uint32_t defaultValue)
+{
+    // An empty count selects the default value.
+
+    if (*pString == 0)
+    {
+        value = defaultValue;
+        return true;
+    }
+
+    uint32_t count = 0;
+
+    for (; *pString; pString++)
+    {
+        if (*pString < '0' || *pString > '9' || count > 999)
+            return false;
+
+        count = count * 10 + (*pString - '0');
+    }
+
+    if (count == 0)
+        return false;
+
+    value = count;
+    return true;
+}
+
 std::vector<uint8_t> ReadFile(const char* pFileName)
 {
     std::ifstream file(pFileName, std::ios::binary | std::ios::ate);
@@ -163,11 +262,659 @@ bool WriteFile(const char* pFileName, const uint8_t* pData, size_t size)
     return true;
 }
 
+// Compresses the input a chunk at a time with memory bounded by the format window. A file name of "-" selects
+// the standard input or output.
+
+bool CompressStream(const std::string& inputName, const std::string& outputName, const Format& format)
+{
+    constexpr size_t CHUNK_SIZE = 1 << 16;
+
+    std::unique_ptr<StreamCompressor> spCompressor = StreamCompressor::Create(format);
+    if (spCompressor == nullptr)
+    {
+        PrintError(ErrorId::StreamNotSupported);
+        return false;
+    }
+
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    std::ifstream inputFile;
+    std::ofstream outputFile;
+
+    if (inputName != "-")
+    {
+        inputFile.open(inputName, std::ios::binary);
+
+        if (!inputFile)
+        {
+            PrintError(ErrorId::InputFileError);
+            return false;
+        }
+    }
+
+    if (outputName != "-")
+    {
+        outputFile.open(outputName, std::ios::binary);
+
+        if (!outputFile)
+        {
+            PrintError(ErrorId::OutputFileError);
+            return false;
+        }
+    }
+
+    std::istream& inputStream = (inputName == "-") ? std::cin : inputFile;
+    std::ostream& outputStream = (outputName == "-") ? std::cout : outputFile;
+
+    std::vector<uint8_t> chunk(CHUNK_SIZE);
+    std::vector<uint8_t> output;
+    uint64_t inputSize = 0;
+    uint64_t outputSize = 0;
+    bool success = true;
+
+    while (success)
+    {
+        // A short read marks the end of the input, the next read then returns nothing.
+
+        inputStream.read(reinterpret_cast<char*>(chunk.data()), chunk.size());
+        size_t size = static_cast<size_t>(inputStream.gcount());
+
+        if (size == 0)
+        {
+            spCompressor->Finish(output);
+        }
+        else
+        {
+            spCompressor->Write(chunk.data(), size, output);
+            inputSize += size;
+        }
+
+        if (!output.empty() && !outputStream.write(reinterpret_cast<const char*>(output.data()), output.size()))
+        {
+            PrintError(ErrorId::OutputFileError);
+            success = false;
+        }
+
+        outputSize += output.size();
+        output.clear();
+
+        if (size == 0)
+            break;
+    }
+
+    if (success && inputStream.bad())
+    {
+        PrintError(ErrorId::InputFileError);
+        success = false;
+    }
+
+    if (success && inputSize == 0)
+    {
+        PrintError(ErrorId::FileEmpty);
+        success = false;
+    }
+
+    // Closing the file also flushes it, failures of earlier writes have already been reported.
+
+    if (outputName != "-")
+    {
+        outputFile.close();
+    }
+    else
+    {
+        outputStream.flush();
+    }
+
+    if (success && !outputStream)
+    {
+        PrintError(ErrorId::OutputFileError);
+        success = false;
+    }
+
+    if (success && outputSize >= inputSize)
+    {
+        PrintWarning(WarningId::NoSizeGain);
+    }
+
+    return success;
+}
+
+// Sizes of the Z80 decoders in asm/Z80, including setup. They decode reverse streams with inverted bits and check
+// for the end-of-stream marker. Each enabled option adds a 1-byte instruction. The hardcore decoders support no
+// options and rely on further assumptions listed in their sources.
+
+struct Decoder
+{
+    const char* pName;
+    FormatId formatId;
+    bool hardcore;
+    uint32_t size;
+};
+
+const Decoder decoders[] =
+{
+    {"DecodeLZM", FormatId::LZM, false, 27},
+    {"DecodeLZM-hardcore", FormatId::LZM, true, 23},
+    {"DecodeEF8", FormatId::EF8, false, 39},
+    {"DecodeBX0", FormatId::BX0, false, 68},
+    {"DecodeBX2", FormatId::BX2, false, 57},
+    {"DecodeBX2-hardcore", FormatId::BX2, true, 49}
+};
+
+// Returns zero if the decoder cannot decode streams with the given options.
+
+uint32_t GetDecoderSize(const Decoder& decoder, FormatOptions options)
+{
+    if (decoder.formatId != options.id || !options.reverse || (options.naturalStream && options.id != FormatId::LZM))
+        return 0;
+
+    if (decoder.hardcore)
+        return (options.endMarker || options.extendOffset || options.extendLength) ? 0 : decoder.size;
+
+    return decoder.size - !options.endMarker + options.extendOffset + options.extendLength;
+}
+
+const char* GetFormatName(FormatId id)
+{
+    switch (id)
+    {
+        case FormatId::LZM:
+            return "lzm";
+
+        case FormatId::EF8:
+            return "ef8";
+
+        case FormatId::BX0:
+            return "bx0";
+
+        case FormatId::BX2:
+            return "bx2";
+    }
+
+    return "";
+}
+
+std::string GetOptionString(FormatOptions options)
+{
+    std::string string = std::string("-") + GetFormatName(static_cast<FormatId>(options.id));
+
+    string += options.reverse ? " -r" : "";
+    string += options.endMarker ? " -e" : "";
+    string += options.extendOffset ? " -o" : "";
+    string += options.extendLength ? " -l" : "";
+
+    return string;
+}
+
+// Compresses the input with every format and every combination of the options that affect the stream size, and
+// returns the smallest stream. The runs are spread over the threads of the parser options and share a matcher
+// per direction. If decoders are counted, only streams with a decoder are ranked by their total size. The input
+// and the format are replaced with the ones of the chosen stream.
+
+BitStream CompressAuto(std::vector<uint8_t>& inputData, std::unique_ptr<Format>& spFormat, bool naturalStream, bool countDecoders, MatchFinderId finderId, const ParserOptions& parserOptions)
+{
+    uint32_t inputSize = static_cast<uint32_t>(inputData.size());
+    bool blockMode = parserOptions.blockSize != 0 && inputSize > parserOptions.blockSize;
+
+    std::vector<uint8_t> reverseData(inputData.rbegin(), inputData.rend());
+
+    // The slowest formats come first, so that the threads stay busy towards the end.
+
+    std::vector<std::unique_ptr<Format>> formats;
+    std::vector<FormatOptions> formatOptions;
+
+    for (FormatId id: {FormatId::BX0, FormatId::BX2, FormatId::EF8, FormatId::LZM})
+    {
+        for (uint32_t flags = 0; flags < 16; flags++)
+        {
+            FormatOptions options = {};
+            options.id = id;
+            options.reverse = flags & 1;
+            options.endMarker = (flags >> 1) & 1;
+            options.extendOffset = (flags >> 2) & 1;
+            options.extendLength = (flags >> 3) & 1;
+            options.naturalStream = naturalStream;
+
+            std::unique_ptr<Format> spRunFormat = Format::Create(options);
+            if (spRunFormat == nullptr)
+                return {};
+
+            if ((options.extendOffset && !spRunFormat->SupportsExtendOffset()) || (options.extendLength && !spRunFormat->SupportsExtendLength()))
+                continue;
+
+            // Inputs and blocks of the repeat offset formats must stay below 64 KiB.
+
+            if (spRunFormat->SupportsRepOffset() && (blockMode ? parserOptions.blockSize >= 0xFFFF : inputSize >= 0xFFFF))
+                continue;
+
+            if (countDecoders && std::none_of(std::begin(decoders), std::end(decoders), [&](const Decoder& decoder) { return GetDecoderSize(decoder, options) != 0; }))
+                continue;
+
+            formats.push_back(std::move(spRunFormat));
+            formatOptions.push_back(options);
+        }
+    }
+
+    // Runs in the same direction share a matcher with the widest limits among them, each run restricts it to
+    // the limits of its format.
+
+    struct MatcherLimits
+    {
+        uint16_t minMatchLength = UINT16_MAX;
+        uint16_t maxMatchLength = 0;
+        uint16_t maxMatchOffset = 0;
+    };
+
+    MatcherLimits matcherLimits[2];
+
+    for (size_t i = 0; i < formats.size() && !blockMode; i++)
+    {
+        const Format& format = *formats[i];
+        MatcherLimits& limits = matcherLimits[format.Reverse()];
+
+        limits.minMatchLength = std::min(limits.minMatchLength, format.MinMatchLength());
+        limits.maxMatchLength = std::max(limits.maxMatchLength, format.MaxMatchLength());
+        limits.maxMatchOffset = std::max(limits.maxMatchOffset, format.MaxMatchOffset());
+    }
+
+    ParserOptions runOptions = parserOptions;
+    runOptions.threadCount = 1;
+    runOptions.pStats = nullptr;
+
+    WorkerPool workerPool(std::max(parserOptions.threadCount, 1u));
+    std::unique_ptr<MatchFinder> matchers[2];
+    std::vector<BitStream> streams(formats.size());
+
+    workerPool.Run(2, [&](uint32_t reverse)
+    {
+        const MatcherLimits& limits = matcherLimits[reverse];
+        const uint8_t* pInput = reverse ? reverseData.data() : inputData.data();
+
+        if (limits.maxMatchOffset != 0)
+        {
+            matchers[reverse] = MatchFinder::Create(finderId, pInput, inputSize, limits.minMatchLength, limits.maxMatchLength, limits.maxMatchOffset);
+        }
+    });
+
+    workerPool.Run(static_cast<uint32_t>(formats.size()), [&](uint32_t runIndex)
+    {
+        const Format& format = *formats[runIndex];
+        const uint8_t* pInput = format.Reverse() ? reverseData.data() : inputData.data();
+
+        if (blockMode)
+        {
+            streams[runIndex] = Compress(pInput, inputSize, format, finderId, runOptions);
+        }
+        else if (matchers[format.Reverse()] != nullptr)
+        {
+            streams[runIndex] = Compress(pInput, inputSize, format, *matchers[format.Reverse()], runOptions);
+        }
+    });
+
+    // Rank the streams (with each of their decoders) by size. Equal sizes keep the order of the runs.
+
+    struct Result
+    {
+        size_t runIndex;
+        const Decoder* pDecoder;
+        size_t totalSize;
+    };
+
+    std::vector<Result> results;
+
+    for (size_t i = 0; i < formats.size(); i++)
+    {
+        if (streams[i].Size() == 0)
+            continue;
+
+        if (!countDecoders)
+        {
+            results.push_back(Result{i, nullptr, streams[i].Size()});
+            continue;
+        }
+
+        for (const Decoder& decoder: decoders)
+        {
+            uint32_t decoderSize = GetDecoderSize(decoder, formatOptions[i]);
+
+            if (decoderSize != 0)
+            {
+                results.push_back(Result{i, &decoder, streams[i].Size() + decoderSize});
+            }
+        }
+    }
+
+    if (results.empty())
+        return {};
+
+    std::stable_sort(results.begin(), results.end(), [](const Result& a, const Result& b) { return a.totalSize < b.totalSize; });
+
+    printf(countDecoders ? "Rank  Options           Stream  Decoder               Total\n" : "Rank  Options           Stream\n");
+
+    for (size_t rank = 0; rank < results.size(); rank++)
+    {
+        const Result& result = results[rank];
+        printf("%4zu  %-16s  %6zu", rank + 1, GetOptionString(formatOptions[result.runIndex]).c_str(), streams[result.runIndex].Size());
+
+        if (result.pDecoder != nullptr)
+        {
+            printf("  %-20s  %5zu", result.pDecoder->pName, result.totalSize);
+        }
+
+        printf("\n");
+    }
+
+    if (results[0].pDecoder != nullptr && results[0].pDecoder->hardcore)
+    {
+        printf("The hardcore decoder relies on the assumptions listed in asm/Z80/%s.asm.\n", results[0].pDecoder->pName);
+    }
+
+    size_t runIndex = results[0].runIndex;
+    spFormat = std::move(formats[runIndex]);
+
+    if (spFormat->Reverse())
+    {
+        inputData.swap(reverseData);
+    }
+
+    return std::move(streams[runIndex]);
+}
+
+// Returns the size of the physical memory, or zero if it is unknown.
+
+uint64_t GetPhysicalMemorySize()
+{
+#if defined(_WIN32)
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+
+    return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+    long pageCount = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+
+    return (pageCount > 0 && pageSize > 0) ? static_cast<uint64_t>(pageCount) * static_cast<uint64_t>(pageSize) : 0;
+#endif
+}
+
+// Lets jobs run while their estimated memory adds up to no more than the limit. A job that exceeds the limit on
+// its own waits until it can run alone.
+
+class MemoryLimit
+{
+public:
+
+    MemoryLimit(uint64_t limit):
+        mLimit{limit}
+    {}
+
+    void Acquire(uint64_t size)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [&]() { return mUsedSize == 0 || mUsedSize + size <= mLimit; });
+        mUsedSize += size;
+    }
+
+    void Release(uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mUsedSize -= size;
+        mCondition.notify_all();
+    }
+
+private:
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    uint64_t mLimit;
+    uint64_t mUsedSize = 0;
+};
+
+struct BatchJob
+{
+    std::string inputName;
+    std::string outputName;
+    uint64_t inputSize;
+};
+
+// Each line of a manifest names an input file, optionally followed by a tab and the output file.
+
+bool ReadManifest(const char* pFileName, const std::string& suffix, std::vector<BatchJob>& jobs)
+{
+    std::ifstream file(pFileName);
+
+    if (!file)
+    {
+        PrintError(ErrorId::InputFileError);
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (line.empty())
+            continue;
+
+        size_t tabPos = line.find('\t');
+
+        if (tabPos == std::string::npos)
+        {
+            jobs.push_back(BatchJob{line, line + suffix, 0});
+        }
+        else
+        {
+            jobs.push_back(BatchJob{line.substr(0, tabPos), line.substr(tabPos + 1), 0});
+        }
+    }
+
+    if (file.bad())
+    {
+        PrintError(ErrorId::InputFileError);
+        return false;
+    }
+
+    return true;
+}
+
+// The batch arguments are pairs of an input and an output file, or manifests prefixed with @.
+
+bool GetBatchJobs(const std::vector<std::string>& names, const std::string& suffix, std::vector<BatchJob>& jobs)
+{
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (names[i][0] == '@')
+        {
+            pJobName = names[i].c_str() + 1;
+            bool success = ReadManifest(pJobName, suffix, jobs);
+            pJobName = nullptr;
+
+            if (!success)
+                return false;
+        }
+        else if (i + 1 < names.size())
+        {
+            jobs.push_back(BatchJob{names[i], names[i + 1], 0});
+            i++;
+        }
+        else
+        {
+            PrintError(ErrorId::BatchIncomplete, names[i].c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Compresses the input of a job once its estimated memory fits within the limit.
+
+bool CompressJob(const BatchJob& job, const Format& format, MatchFinderId finderId, const ParserOptions& parserOptions, MemoryLimit& memoryLimit)
+{
+    std::vector<uint8_t> inputData = ReadFile(job.inputName.c_str());
+    if (inputData.empty())
+        return false;
+
+    if (format.SupportsRepOffset() && inputData.size() >= 0xFFFF && parserOptions.blockSize == 0)
+    {
+        PrintError(ErrorId::FileTooBig);
+        return false;
+    }
+
+    if (format.Reverse())
+    {
+        std::reverse(inputData.begin(), inputData.end());
+    }
+
+    uint32_t inputSize = static_cast<uint32_t>(inputData.size());
+    uint64_t memorySize = EstimateCompressionMemory(inputData.data(), inputSize, format, parserOptions);
+
+    memoryLimit.Acquire(memorySize);
+
+    BitStream packedStream;
+
+    try
+    {
+        packedStream = Compress(inputData.data(), inputSize, format, finderId, parserOptions);
+    }
+    catch (...)
+    {
+        memoryLimit.Release(memorySize);
+        throw;
+    }
+
+    memoryLimit.Release(memorySize);
+
+    if (packedStream.Size() == 0)
+    {
+        PrintError(ErrorId::CompressionFailed);
+        return false;
+    }
+
+    if (packedStream.Size() >= inputData.size())
+    {
+        PrintWarning(WarningId::NoSizeGain);
+    }
+
+#ifdef VERIFY
+
+    if (format.Reverse())
+    {
+        std::reverse(inputData.begin(), inputData.end());
+    }
+
+    std::vector<uint8_t> unpackedData = Decompress(packedStream, format, inputSize);
+
+    if (unpackedData.size() != inputData.size() || !std::equal(inputData.begin(), inputData.end(), unpackedData.data()))
+    {
+        PrintError(ErrorId::VerificationFailed);
+        return false;
+    }
+
+#endif // VERIFY
+
+    return WriteFile(job.outputName.c_str(), packedStream.Data(), packedStream.Size());
+}
+
+// Compresses many files with the same format. The jobs run one per thread, the largest inputs first so that the
+// threads stay busy towards the end. Jobs that run at the same time keep their estimated memory within the limit.
+// Each failed job reports its own errors and the rest of the batch goes on.
+
+bool CompressBatch(const std::vector<std::string>& names, const std::string& suffix, const Format& format, MatchFinderId finderId, const ParserOptions& parserOptions, uint64_t memoryLimitSize)
+{
+    std::vector<BatchJob> jobs;
+
+    if (!GetBatchJobs(names, suffix, jobs))
+        return false;
+
+    if (jobs.empty())
+        return true;
+
+    for (BatchJob& job: jobs)
+    {
+        std::ifstream file(job.inputName, std::ios::binary | std::ios::ate);
+        job.inputSize = file ? static_cast<uint64_t>(std::max<std::streamoff>(file.tellg(), 0)) : 0;
+    }
+
+    std::stable_sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a.inputSize > b.inputSize; });
+
+    ParserOptions jobOptions = parserOptions;
+    jobOptions.threadCount = 1;
+
+    MemoryLimit memoryLimit(memoryLimitSize);
+    WorkerPool workerPool(static_cast<uint32_t>(std::min<size_t>(std::max(parserOptions.threadCount, 1u), jobs.size())));
+    std::atomic<uint32_t> failedCount{0};
+
+    workerPool.Run(static_cast<uint32_t>(jobs.size()), [&](uint32_t jobIndex)
+    {
+        const BatchJob& job = jobs[jobIndex];
+        bool success = false;
+
+        pJobName = job.inputName.c_str();
+
+        try
+        {
+            success = CompressJob(job, format, finderId, jobOptions, memoryLimit);
+        }
+        catch (const std::bad_alloc&)
+        {
+            PrintError(ErrorId::OutOfMemory);
+        }
+        catch (const std::exception& exception)
+        {
+            PrintError(ErrorId::UnexpectedError, exception.what());
+        }
+        catch (...)
+        {
+            PrintError(ErrorId::UnexpectedError, "unknown exception");
+        }
+
+        pJobName = nullptr;
+
+        if (!success)
+        {
+            failedCount++;
+        }
+    });
+
+    if (failedCount != 0)
+    {
+        std::string count = std::to_string(failedCount.load()) + " of " + std::to_string(jobs.size());
+        PrintError(ErrorId::JobsFailed, count.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void PrintStats(const ParserStats& stats)
+{
+    printf("Parse cost: %u bits (bounds %u..%u).\n", stats.cost, stats.lowerBound, stats.upperBound);
+    printf("Match relaxations: %llu, pruned: %llu (%.1f%%).\n", static_cast<unsigned long long>(stats.relaxations),
+        static_cast<unsigned long long>(stats.prunedRelaxations), stats.relaxations ? 100.0 * stats.prunedRelaxations / stats.relaxations : 0.0);
+}
+
+// Beam width of the approximate parse if the option has no count.
+
+constexpr uint32_t DEFAULT_BEAM_WIDTH = 4;
+
+// Block size in KiB if the option has no count.
+
+constexpr uint32_t DEFAULT_BLOCK_SIZE = 32;
+
 int main(int argCount, char** args)
 {
     if (argCount < 2)
     {
-        printf("\nUsage: bzpack.exe [-lzm|-ef8|-bx0|-bx2] [-r] [-e] [-o] [-l] [-n] <inputFile> [outputFile]\n");
+        printf("\nUsage: bzpack.exe [-lzm|-ef8|-bx0|-bx2] [-r] [-e] [-o] [-l] [-n] [-s] [-t[count]] [-b[width]] [-p[size]] [-g] [-v] [-c] [-auto] [-z80] [-batch] [-M[size]] <inputFile> [outputFile]\n");
         printf("\nOptions:\n\n");
         printf("-lzm: Byte-aligned LZSS. Raw 7-bit length, raw 8-bit offset (default).\n");
         printf("-ef8: Elias length, raw 8-bit offset.\n");
@@ -178,11 +925,33 @@ int main(int argCount, char** args)
         printf("-o: Extend the offset range by 1.\n");
         printf("-l: Extend the block length by 1.\n");
         printf("-n: Produce natural stream without stream-level optimizations.\n");
+        printf("-s: Find matches using a suffix array (faster on large repetitive inputs).\n");
+        printf("-t[count]: Parse using multiple threads (BX0 and BX2, blocks, -auto or -batch only, all hardware threads if no count is given).\n");
+        printf("-b[width]: Approximate the parse with a beam of the given width (BX0 and BX2 only, %u if no width is given).\n", DEFAULT_BEAM_WIDTH);
+        printf("-p[size]: Parse blocks of the given size in KiB concurrently (%u if no size is given, required for BX0 and BX2 inputs of 64 KiB or more).\n", DEFAULT_BLOCK_SIZE);
+        printf("-g: Report the size gap of the approximate parse against the exact parse.\n");
+        printf("-v: Report how much work the exact parse pruned (BX0 and BX2 only).\n");
+        printf("-auto: Compress with every format and option combination and keep the smallest stream (the format options are ignored).\n");
+        printf("-z80: Together with -auto, rank the streams by their size plus the size of their Z80 decoder.\n");
+        printf("-c: Compress as a stream in constant memory (forward LZM and EF8 only, - names the standard input or output).\n");
+        printf("-batch: Compress many files on the threads of -t. The files are pairs of input and output files, or manifests prefixed with @\n");
+        printf("        that list an input file per line, optionally followed by a tab and the output file.\n");
+        printf("-M[size]: Limit the estimated memory of the batch jobs that run at the same time to the given size in GiB (physical memory if no size is given).\n");
         return 0;
     }
 
     static std::string suffix = ".lzm";
     static FormatOptions options = {0};
+    static MatchFinderId finderId = MatchFinderId::WordChains;
+    static ParserOptions parserOptions;
+    static bool reportGap = false;
+    static bool streamMode = false;
+    static bool autoMode = false;
+    static bool countDecoders = false;
+    static bool batchMode = false;
+    static uint32_t memoryLimit = 0;
+    static uint32_t blockSize = 0;
+    static ParserStats parserStats;
 
     static const std::unordered_map<std::string, std::function<void()>> actions =
     {
@@ -194,55 +963,64 @@ int main(int argCount, char** args)
         {"-e",   [&]() { options.endMarker = 1; }},
         {"-o",   [&]() { options.extendOffset = 1; }},
         {"-l",   [&]() { options.extendLength = 1; }},
-        {"-n",   [&]() { options.naturalStream = 1; }}
+        {"-n",   [&]() { options.naturalStream = 1; }},
+        {"-s",   [&]() { finderId = MatchFinderId::SuffixArray; }},
+        {"-g",   [&]() { reportGap = true; }},
+        {"-v",   [&]() { parserOptions.pStats = &parserStats; }},
+        {"-c",   [&]() { streamMode = true; }},
+        {"-auto", [&]() { autoMode = true; }},
+        {"-z80", [&]() { countDecoders = true; }},
+        {"-batch", [&]() { batchMode = true; }}
     };
 
-    // Process command line arguments.
+    // Process command line arguments. Options precede the file names.
 
-    std::string inputName, outputName;
+    std::vector<std::string> fileNames;
 
     for (int i = 1; i < argCount; i++)
     {
-        if (inputName.empty())
+        if (fileNames.empty() && args[i][0] == '-' && args[i][1] != 0)
         {
-            if (args[i][0] == '-')
+            auto iAction = actions.find(args[i]);
+            if (iAction != actions.end())
             {
-                auto iAction = actions.find(args[i]);
-                if (iAction != actions.end())
-                {
-                    iAction->second();
-                }
-                else
-                {
-                    PrintError(ErrorId::InvalidParam, args[i]);
-                    return 1;
-                }
+                iAction->second();
             }
-            else
+            else if (!(args[i][1] == 't' && ParseCount(args[i] + 2, parserOptions.threadCount, std::max(std::thread::hardware_concurrency(), 1u))) &&
+                     !(args[i][1] == 'b' && ParseCount(args[i] + 2, parserOptions.beamWidth, DEFAULT_BEAM_WIDTH)) &&
+                     !(args[i][1] == 'p' && ParseCount(args[i] + 2, blockSize, DEFAULT_BLOCK_SIZE)) &&
+                     !(args[i][1] == 'M' && ParseCount(args[i] + 2, memoryLimit, 0)))
             {
-                inputName = args[i];
+                PrintError(ErrorId::InvalidParam, args[i]);
+                return 1;
             }
         }
-        else if (outputName.empty())
-        {
-            outputName = args[i];
-        }
         else
         {
-            PrintError(ErrorId::InvalidParam, args[i]);
-            return 1;
+            fileNames.push_back(args[i]);
         }
     }
 
-    if (inputName.empty())
+    if (fileNames.empty())
     {
         PrintError(ErrorId::InputFileError);
         return 1;
     }
 
+    if (fileNames.size() > 2 && !batchMode)
+    {
+        PrintError(ErrorId::InvalidParam, fileNames[2].c_str());
+        return 1;
+    }
+
+    std::string inputName = fileNames[0];
+    std::string outputName = (fileNames.size() > 1) ? fileNames[1] : "";
+
+    bool defaultOutputName = outputName.empty();
+
     if (outputName.empty())
     {
-        outputName = inputName + suffix;
+        outputName = (inputName == "-") ? inputName : inputName + suffix;
     }
 
     std::unique_ptr<Format> spFormat = Format::Create(options);
@@ -254,6 +1032,33 @@ int main(int argCount, char** args)
 
     ValidateOptions(options, *spFormat);
 
+    if (batchMode && (streamMode || autoMode || reportGap || parserOptions.pStats != nullptr))
+    {
+        PrintError(ErrorId::BatchNotSupported);
+        return 1;
+    }
+
+    if (streamMode)
+    {
+        return CompressStream(inputName, outputName, *spFormat) ? 0 : 1;
+    }
+
+    // Blocks of the repeat offset formats share the input size limit.
+
+    parserOptions.blockSize = blockSize * 1024;
+
+    if (spFormat->SupportsRepOffset() && parserOptions.blockSize >= 0xFFFF && !autoMode)
+    {
+        PrintError(ErrorId::BlockTooBig);
+        return 1;
+    }
+
+    if (batchMode)
+    {
+        uint64_t memoryLimitSize = (memoryLimit != 0) ? (static_cast<uint64_t>(memoryLimit) << 30) : GetPhysicalMemorySize();
+        return CompressBatch(fileNames, suffix, *spFormat, finderId, parserOptions, (memoryLimitSize != 0) ? memoryLimitSize : UINT64_MAX) ? 0 : 1;
+    }
+
     // Read input file.
 
     std::vector<uint8_t> inputData = ReadFile(inputName.c_str());
@@ -262,20 +1067,35 @@ int main(int argCount, char** args)
         return 1;
     }
 
-    if (spFormat->SupportsRepOffset() && inputData.size() >= 0xFFFF)
+    if (spFormat->SupportsRepOffset() && inputData.size() >= 0xFFFF && parserOptions.blockSize == 0 && !autoMode)
     {
         PrintError(ErrorId::FileTooBig);
         return 1;
     }
 
-    if (spFormat->Reverse())
+    // Compress the input stream.
+
+    BitStream packedStream;
+
+    if (autoMode)
     {
-        std::reverse(inputData.begin(), inputData.end());
+        packedStream = CompressAuto(inputData, spFormat, options.naturalStream, countDecoders, finderId, parserOptions);
+
+        if (defaultOutputName)
+        {
+            outputName = inputName + "." + GetFormatName(spFormat->Id());
+        }
     }
+    else
+    {
+        if (spFormat->Reverse())
+        {
+            std::reverse(inputData.begin(), inputData.end());
+        }
 
-    // Compress the input stream.
+        packedStream = Compress(inputData.data(), static_cast<uint32_t>(inputData.size()), *spFormat, finderId, parserOptions);
+    }
 
-    BitStream packedStream = Compress(inputData.data(), static_cast<uint32_t>(inputData.size()), *spFormat);
     if (packedStream.Size() == 0)
     {
         PrintError(ErrorId::CompressionFailed);
@@ -287,6 +1107,30 @@ int main(int argCount, char** args)
         PrintWarning(WarningId::NoSizeGain);
     }
 
+    if (parserOptions.pStats != nullptr && parserOptions.beamWidth == 0 && spFormat->SupportsRepOffset() && !autoMode)
+    {
+        PrintStats(parserStats);
+    }
+
+    // Compare the approximate parse with the exact one.
+
+    if (reportGap && parserOptions.beamWidth != 0 && spFormat->SupportsRepOffset() && !autoMode)
+    {
+        ParserOptions exactOptions = parserOptions;
+        exactOptions.beamWidth = 0;
+
+        BitStream exactStream = Compress(inputData.data(), static_cast<uint32_t>(inputData.size()), *spFormat, finderId, exactOptions);
+        if (exactStream.Size() == 0)
+        {
+            PrintError(ErrorId::CompressionFailed);
+            return 1;
+        }
+
+        double gap = static_cast<double>(packedStream.Size()) - static_cast<double>(exactStream.Size());
+        printf("Approximate parse: %zu bytes, exact parse: %zu bytes, gap: %.0f bytes (%.2f%%).\n",
+            packedStream.Size(), exactStream.Size(), gap, 100.0 * gap / exactStream.Size());
+    }
+
 #ifdef VERIFY
 
     if (spFormat->Reverse())
@@ -305,11 +1149,6 @@ int main(int argCount, char** args)
 
     // Write output file.
 
-    if (spFormat->Reverse())
-    {
-        packedStream.Reverse();
-    }
-
     if (!WriteFile(outputName.c_str(), packedStream.Data(), packedStream.Size()))
     {
         return 1;    
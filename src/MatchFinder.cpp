@@ -0,0 +1,110 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#include "MatchFinder.h"
+#include <algorithm>
+#include "PrefixMatcher.h"
+#include "SuffixMatcher.h"
+
+// Searches the history together with the input and hides the history positions from the caller.
+
+class HistoryMatcher final: public MatchFinder
+{
+public:
+
+    HistoryMatcher(std::unique_ptr<MatchFinder> spMatcher, uint32_t historySize):
+        mspMatcher{std::move(spMatcher)}, mHistorySize{historySize}
+    {}
+
+    size_t GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes = false, uint16_t maxOffset = UINT16_MAX) const override
+    {
+        return mspMatcher->GetMatches(matches, inputPos + mHistorySize, allowBytes, maxOffset);
+    }
+
+    size_t GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset = UINT16_MAX) const override
+    {
+        return mspMatcher->GetByteMatches(matches, inputPos + mHistorySize, maxOffset);
+    }
+
+private:
+
+    std::unique_ptr<MatchFinder> mspMatcher;
+    uint32_t mHistorySize;
+};
+
+// Narrows the window of the queries and clamps the match lengths of a wider matcher.
+
+class LimitedMatcher final: public MatchFinder
+{
+public:
+
+    LimitedMatcher(const MatchFinder& matcher, uint16_t minMatchLength, uint16_t maxMatchLength, uint16_t maxMatchOffset):
+        mMatcher{matcher}, mMinMatchLength{minMatchLength}, mMaxMatchLength{maxMatchLength}, mMaxMatchOffset{maxMatchOffset}
+    {}
+
+    size_t GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes = false, uint16_t maxOffset = UINT16_MAX) const override
+    {
+        mMatcher.GetMatches(matches, inputPos, allowBytes, std::min(mMaxMatchOffset, maxOffset));
+
+        // Matches cut below the minimum length only keep their byte match.
+
+        size_t keptCount = 0;
+
+        for (const MatchRange& match: matches)
+        {
+            uint16_t maxLength = std::min(match.maxLength, mMaxMatchLength);
+
+            if (maxLength >= 2 && maxLength >= mMinMatchLength)
+            {
+                matches[keptCount++] = MatchRange{allowBytes ? static_cast<uint16_t>(1) : mMinMatchLength, maxLength, match.offset};
+            }
+            else if (allowBytes)
+            {
+                matches[keptCount++] = MatchRange{1, 1, match.offset};
+            }
+        }
+
+        matches.erase(matches.begin() + keptCount, matches.end());
+
+        return matches.size();
+    }
+
+    size_t GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset = UINT16_MAX) const override
+    {
+        return mMatcher.GetByteMatches(matches, inputPos, std::min(mMaxMatchOffset, maxOffset));
+    }
+
+private:
+
+    const MatchFinder& mMatcher;
+    uint16_t mMinMatchLength;
+    uint16_t mMaxMatchLength;
+    uint16_t mMaxMatchOffset;
+};
+
+std::unique_ptr<MatchFinder> MatchFinder::Create(MatchFinderId id, const uint8_t* pInput, uint32_t inputSize, uint16_t minMatchLength, uint16_t maxMatchLength, uint16_t maxMatchOffset, uint32_t historySize)
+{
+    if (historySize > 0)
+    {
+        std::unique_ptr<MatchFinder> spMatcher = Create(id, pInput - historySize, historySize + inputSize, minMatchLength, maxMatchLength, maxMatchOffset);
+        if (spMatcher == nullptr)
+            return nullptr;
+
+        return std::unique_ptr<MatchFinder>(new HistoryMatcher(std::move(spMatcher), historySize));
+    }
+
+    switch (id)
+    {
+    case MatchFinderId::WordChains:
+        return std::unique_ptr<MatchFinder>(new PrefixMatcher(pInput, inputSize, minMatchLength, maxMatchLength, maxMatchOffset));
+    case MatchFinderId::SuffixArray:
+        return std::unique_ptr<MatchFinder>(new SuffixMatcher(pInput, inputSize, minMatchLength, maxMatchLength, maxMatchOffset));
+    }
+
+    return nullptr;
+}
+
+std::unique_ptr<MatchFinder> MatchFinder::Create(const MatchFinder& matcher, uint16_t minMatchLength, uint16_t maxMatchLength, uint16_t maxMatchOffset)
+{
+    return std::unique_ptr<MatchFinder>(new LimitedMatcher(matcher, minMatchLength, maxMatchLength, maxMatchOffset));
+}
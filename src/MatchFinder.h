@@ -0,0 +1,56 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#ifndef MATCH_FINDER_H
+#define MATCH_FINDER_H
+
+#include <memory>
+#include <vector>
+#include "CommonTypes.h"
+
+enum MatchFinderId
+{
+    WordChains,
+    SuffixArray
+};
+
+// All match finders report the same matches. They only differ in speed and memory footprint. Matches may also
+// refer to a history of bytes that precedes the input (input positions stay relative to the input). A query may
+// narrow the offset window further, which spares walking the rest of it.
+
+class MatchFinder
+{
+public:
+
+    virtual ~MatchFinder() = default;
+
+    static std::unique_ptr<MatchFinder> Create(
+        MatchFinderId id,
+        const uint8_t* pInput,
+        uint32_t inputSize,
+        uint16_t minMatchLength,
+        uint16_t maxMatchLength,
+        uint16_t maxMatchOffset,
+        uint32_t historySize = 0
+    );
+
+    // Restricts a matcher built with a wider window or longer matches to the given limits, so that one matcher
+    // serves several formats. The matches are the same as those of a matcher built with these limits, and the
+    // wider matcher must outlive the result.
+
+    static std::unique_ptr<MatchFinder> Create(
+        const MatchFinder& matcher,
+        uint16_t minMatchLength,
+        uint16_t maxMatchLength,
+        uint16_t maxMatchOffset
+    );
+
+    virtual size_t GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes = false, uint16_t maxOffset = UINT16_MAX) const = 0;
+    virtual size_t GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset = UINT16_MAX) const = 0;
+
+protected:
+
+    MatchFinder() = default;
+};
+
+#endif // MATCH_FINDER_H
@@ -3,19 +3,27 @@
 
 #include "OptimalParser.h"
 #include <algorithm>
-#include "PrefixMatcher.h"
+#include <cassert>
 
-std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inputSize, const Format& format)
+template<class FormatType>
+std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inputSize, const FormatType& format, const MatchFinder& matcher)
 {
     if (pInput == nullptr || inputSize == 0)
         return {};
 
-    // Precompute all available matches for each input position.
+    std::vector<MatchRange> matches;
 
-    std::vector<Match> matches;
-    PrefixMatcher matcher(pInput, inputSize, format.MinMatchLength(), format.MaxMatchLength(), format.MaxMatchOffset());
+    // Match costs never decrease with the offset, so of all matches with the same length only the lowest offset
+    // needs to be relaxed.
 
-    // Initialize the state and sweep over all coding paths at each input position.
+    for (uint16_t offset = 1; offset < format.MaxMatchOffset(); offset++)
+    {
+        assert(format.GetMatchCost(format.MinMatchLength(), offset) <= format.GetMatchCost(format.MinMatchLength(), offset + 1));
+        assert(format.GetMatchCost(format.MaxMatchLength(), offset) <= format.GetMatchCost(format.MaxMatchLength(), offset + 1));
+    }
+
+    // Initialize the state and sweep over all coding paths at each input position. Of equally expensive paths,
+    // the one from the latest position is kept, so paths that tie tend to meet (see StreamingParser).
 
     std::vector<PathNode> nodes(inputSize + 1);
     nodes[0].cost = 0;
@@ -26,14 +34,14 @@ std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inpu
 
         // Propagate literals.
 
-        uint16_t maxLength = std::min<uint16_t>(inputSize - inputPos, format.MaxLiteralLength());
+        uint16_t maxLength = static_cast<uint16_t>(std::min<uint32_t>(inputSize - inputPos, format.MaxLiteralLength()));
 
         for (uint16_t length = 1; length <= maxLength; length++)
         {
             PathNode& nextNode = nodes[inputPos + length];
             uint32_t nextCost = node.cost + format.GetLiteralCost(length);
 
-            if (nextCost < nextNode.cost)
+            if (nextCost <= nextNode.cost)
             {
                 nextNode = PathNode{nextCost, length, 0};
             }
@@ -42,15 +50,19 @@ std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inpu
         // Propagate matches.
 
         matcher.GetMatches(matches, inputPos);
+        PruneMatches(matches);
 
-        for (const Match& match: matches)
+        for (const MatchRange& match: matches)
         {
-            PathNode& nextNode = nodes[inputPos + match.length];
-            uint32_t nextCost = node.cost + format.GetMatchCost(match.length, match.offset);
-
-            if (nextCost < nextNode.cost)
+            for (uint16_t length = match.minLength; length <= match.maxLength; length++)
             {
-                nextNode = PathNode{nextCost, match.length, match.offset};
+                PathNode& nextNode = nodes[inputPos + length];
+                uint32_t nextCost = node.cost + format.GetMatchCost(length, match.offset);
+
+                if (nextCost <= nextNode.cost)
+                {
+                    nextNode = PathNode{nextCost, length, match.offset};
+                }
             }
         }
     }
@@ -70,3 +82,27 @@ std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inpu
 
     return parse;
 }
+
+void OptimalParser::PruneMatches(std::vector<MatchRange>& matches)
+{
+    // Matches are sorted by offset in ascending order. Each match only keeps the lengths not already covered
+    // by a lower offset, matches with no lengths left are dropped.
+
+    size_t keptCount = 0;
+    uint16_t coveredLength = 0;
+
+    for (const MatchRange& match: matches)
+    {
+        if (match.maxLength <= coveredLength)
+            continue;
+
+        uint16_t minLength = std::max<uint16_t>(match.minLength, coveredLength + 1);
+        matches[keptCount++] = MatchRange{minLength, match.maxLength, match.offset};
+        coveredLength = match.maxLength;
+    }
+
+    matches.erase(matches.begin() + keptCount, matches.end());
+}
+
+template std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inputSize, const FormatLZM& format, const MatchFinder& matcher);
+template std::vector<ParseStep> OptimalParser::Parse(const uint8_t* pInput, uint32_t inputSize, const FormatEF8& format, const MatchFinder& matcher);
@@ -7,16 +7,22 @@
 #include <vector>
 #include "CommonTypes.h"
 #include "Formats.h"
+#include "MatchFinder.h"
 
 class OptimalParser
 {
 public:
 
-    static std::vector<ParseStep> Parse(const uint8_t* pInput, uint32_t inputSize, const Format& format);
+    // Only instantiated for LZM and EF8.
+
+    template<class FormatType>
+    static std::vector<ParseStep> Parse(const uint8_t* pInput, uint32_t inputSize, const FormatType& format, const MatchFinder& matcher);
     OptimalParser() = delete;
 
 private:
 
+    static void PruneMatches(std::vector<MatchRange>& matches);
+
     struct PathNode
     {
         uint32_t cost = 0xFFFFFFFF;
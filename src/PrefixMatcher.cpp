@@ -4,104 +4,209 @@
 #include "PrefixMatcher.h"
 #include <algorithm>
 
+#if defined(__AVX2__)
+#define BZPACK_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BZPACK_SSE2
+#endif
+
+#if defined(BZPACK_SSE2)
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Returns the index of the lowest set bit (the mask must not be zero).
+
+static uint32_t CountTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+#endif // BZPACK_SSE2
+
 PrefixMatcher::PrefixMatcher(const uint8_t* pInput, uint32_t inputSize, uint16_t minMatchLength, uint16_t maxMatchLength, uint16_t maxMatchOffset):
     mInputPtr{pInput},
     mInputSize{inputSize},
     mMinMatchLength{minMatchLength},
     mMaxMatchLength{maxMatchLength},
     mMaxMatchOffset{maxMatchOffset},
-    mByteMatches{inputSize},
-    mMaxMatches{inputSize}
+    mByteGroups{},
+    mBytePositions(inputSize),
+    mByteIndices(inputSize),
+    mMaxMatchStarts(inputSize + 1)
 {
     if (inputSize < 2)
         return;
 
-    // Gather byte positions and record matches of length 1 within the offset window.
+    // Group the input positions by byte value (counting sort). The earlier positions of the same byte precede
+    // each position in its group.
 
-    std::vector<std::vector<uint32_t>> bytePositions(256);
+    uint32_t groupEnds[256] = {};
 
     for (uint32_t inputPos = 0; inputPos < inputSize; inputPos++)
     {
-        uint8_t byte = pInput[inputPos];
-        uint32_t windowPos = inputPos - std::min<uint32_t>(inputPos, maxMatchOffset);
-
-        for (auto i = bytePositions[byte].rbegin(); i != bytePositions[byte].rend(); i++)
-        {
-            if (*i < windowPos)
-                break;
+        groupEnds[pInput[inputPos]]++;
+    }
 
-            mByteMatches[inputPos].emplace_back(*i);
-        }
+    for (uint32_t byte = 0, groupStart = 0; byte < 256; byte++)
+    {
+        mByteGroups[byte] = groupStart;
+        groupStart += groupEnds[byte];
+        groupEnds[byte] = mByteGroups[byte];
+    }
 
-        bytePositions[byte].emplace_back(inputPos);
+    for (uint32_t inputPos = 0; inputPos < inputSize; inputPos++)
+    {
+        uint32_t index = groupEnds[pInput[inputPos]]++;
+        mBytePositions[index] = inputPos;
+        mByteIndices[inputPos] = index;
     }
 
-    // Gather 2-byte word positions and record maximum match lengths within the offset window.
+    // Chain the 2-byte word positions and record maximum match lengths within the offset window. The matches of
+    // all positions are appended to a single buffer.
 
-    std::vector<std::vector<uint32_t>> wordPositions(65536);
+    std::vector<uint32_t> wordHeads(65536, UINT32_MAX);
+    std::vector<uint32_t> wordChain(inputSize);
 
     for (uint32_t inputPos = 0; inputPos < inputSize - 1; inputPos++)
     {
         uint16_t word = pInput[inputPos] | (pInput[inputPos + 1] << 8);
         uint32_t windowPos = inputPos - std::min<uint32_t>(inputPos, maxMatchOffset);
 
-        for (auto i = wordPositions[word].rbegin(); i != wordPositions[word].rend(); i++)
+        mMaxMatchStarts[inputPos] = static_cast<uint32_t>(mMaxMatches.size());
+
+        for (uint32_t matchPos = wordHeads[word]; matchPos != UINT32_MAX; matchPos = wordChain[matchPos])
         {
-            if (*i < windowPos)
+            if (matchPos < windowPos)
                 break;
 
-            uint16_t matchLength = GetMatchLength(inputPos, *i);
+            uint16_t matchLength = GetMatchLength(inputPos, matchPos);
 
             if (matchLength >= mMinMatchLength)
             {
-                mMaxMatches[inputPos].emplace_back(*i, matchLength);
+                mMaxMatches.emplace_back(matchPos, matchLength);
             }
         }
 
-        wordPositions[word].emplace_back(inputPos);
+        wordChain[inputPos] = wordHeads[word];
+        wordHeads[word] = inputPos;
     }
+
+    mMaxMatchStarts[inputSize - 1] = static_cast<uint32_t>(mMaxMatches.size());
+    mMaxMatchStarts[inputSize] = static_cast<uint32_t>(mMaxMatches.size());
 }
 
-size_t PrefixMatcher::GetMatches(std::vector<Match>& matches, uint32_t inputPos, bool allowBytes) const
+size_t PrefixMatcher::GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes, uint16_t maxOffset) const
 {
     matches.clear();
 
-    // Single-byte matches are cheap to encode and can establish useful repeat offsets.
+    // Matches are sorted by offset in ascending order, one range per offset. Single-byte matches are cheap to
+    // encode and can establish useful repeat offsets, so they optionally extend the ranges (any longer match
+    // also has a byte match at the same offset).
+
+    auto iMaxMatch = mMaxMatches.begin() + mMaxMatchStarts[inputPos];
+    auto iMaxMatchEnd = mMaxMatches.begin() + mMaxMatchStarts[inputPos + 1];
+
+    uint32_t windowPos = inputPos - std::min<uint32_t>(inputPos, std::min(mMaxMatchOffset, maxOffset));
+    uint32_t groupStart = mByteGroups[mInputPtr[inputPos]];
 
-    if (allowBytes)
+    for (uint32_t index = mByteIndices[inputPos]; index-- > groupStart;)
     {
-        for (uint32_t bytePos: mByteMatches[inputPos])
+        uint32_t bytePos = mBytePositions[index];
+
+        if (bytePos < windowPos)
+            break;
+
+        uint16_t offset = inputPos - bytePos;
+
+        if (iMaxMatch != iMaxMatchEnd && iMaxMatch->inputPos == bytePos)
         {
-            matches.emplace_back(1, inputPos - bytePos);
+            matches.emplace_back(allowBytes ? 1 : mMinMatchLength, iMaxMatch->length, offset);
+            iMaxMatch++;
+        }
+        else if (allowBytes)
+        {
+            matches.emplace_back(1, 1, offset);
         }
     }
 
-    size_t byteMatchCount = matches.size();
+    return matches.size();
+}
+
+size_t PrefixMatcher::GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset) const
+{
+    matches.clear();
+
+    uint32_t windowPos = inputPos - std::min<uint32_t>(inputPos, std::min(mMaxMatchOffset, maxOffset));
+    uint32_t groupStart = mByteGroups[mInputPtr[inputPos]];
 
-    for (const MaxMatch& maxMatch: mMaxMatches[inputPos])
+    for (uint32_t index = mByteIndices[inputPos]; index-- > groupStart;)
     {
-        uint16_t offset = inputPos - maxMatch.inputPos;
+        uint32_t bytePos = mBytePositions[index];
 
-        for (uint16_t length = mMinMatchLength; length <= maxMatch.length; length++)
-        {
-            matches.emplace_back(length, offset);
-        }
+        if (bytePos < windowPos)
+            break;
+
+        matches.emplace_back(1, inputPos - bytePos);
     }
 
-    return byteMatchCount;
+    return matches.size();
 }
 
 uint16_t PrefixMatcher::GetMatchLength(uint32_t inputPos, uint32_t matchPos) const
 {
-    uint32_t maxLength = std::min<uint32_t>(mInputSize - inputPos, mMaxMatchLength) - 2;
-    uint16_t length = 2;
-    inputPos += 2;
-    matchPos += 2;
-    
-    while (maxLength-- && mInputPtr[inputPos++] == mInputPtr[matchPos++])
+    // The first two bytes are known to match. Compare the rest a vector at a time where possible, the first
+    // mismatch within a vector is the lowest set bit of the inverted comparison mask.
+
+    uint32_t maxLength = std::min<uint32_t>(mInputSize - inputPos, mMaxMatchLength);
+    uint32_t length = 2;
+
+    const uint8_t* pInput = mInputPtr + inputPos;
+    const uint8_t* pMatch = mInputPtr + matchPos;
+
+#if defined(BZPACK_AVX2)
+
+    for (; length + 32 <= maxLength; length += 32)
+    {
+        __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pInput + length));
+        __m256i match = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pMatch + length));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(input, match)));
+
+        if (mask != 0)
+            return static_cast<uint16_t>(length + CountTrailingZeros(mask));
+    }
+
+#endif
+
+#if defined(BZPACK_SSE2)
+
+    for (; length + 16 <= maxLength; length += 16)
+    {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pInput + length));
+        __m128i match = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pMatch + length));
+        uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(input, match))) & 0xFFFF;
+
+        if (mask != 0)
+            return static_cast<uint16_t>(length + CountTrailingZeros(mask));
+    }
+
+#endif
+
+    while (length < maxLength && pInput[length] == pMatch[length])
     {
         length++;
     }
-    
-    return length;
+
+    return static_cast<uint16_t>(length);
 }
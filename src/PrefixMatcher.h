@@ -5,9 +5,12 @@
 #define PREFIX_MATCHER_H
 
 #include <vector>
-#include "CommonTypes.h"
+#include "MatchFinder.h"
 
-class PrefixMatcher
+// Finds matches by walking the chains of equal bytes and equal 2-byte words within the offset window. Maximum
+// matches are precomputed at construction.
+
+class PrefixMatcher final: public MatchFinder
 {
 public:
 
@@ -21,7 +24,8 @@ public:
         uint16_t maxMatchOffset
     );
 
-    size_t GetMatches(std::vector<Match>& matches, uint32_t inputPos, bool allowBytes = false) const;
+    size_t GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes = false, uint16_t maxOffset = UINT16_MAX) const override;
+    size_t GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset = UINT16_MAX) const override;
 
 private:
 
@@ -44,8 +48,17 @@ private:
     const uint16_t mMaxMatchLength;
     const uint16_t mMaxMatchOffset;
 
-    std::vector<std::vector<uint32_t>> mByteMatches;
-    std::vector<std::vector<MaxMatch>> mMaxMatches;
+    // Input positions grouped by byte value (ascending within each group).
+
+    uint32_t mByteGroups[256];
+    std::vector<uint32_t> mBytePositions;
+    std::vector<uint32_t> mByteIndices;
+
+    // Maximum matches of all positions in a single buffer. The matches at position i occupy the range from
+    // mMaxMatchStarts[i] to mMaxMatchStarts[i + 1].
+
+    std::vector<uint32_t> mMaxMatchStarts;
+    std::vector<MaxMatch> mMaxMatches;
 };
 
 #endif // PREFIX_MATCHER_H
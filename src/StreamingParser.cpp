@@ -0,0 +1,328 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#include "StreamingParser.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// The buffers hold this many input positions. Coding paths are compared every SETTLE_INTERVAL positions, and if
+// they still disagree after SETTLE_LIMIT positions, the path of the frontier is settled up to a step behind it.
+
+constexpr uint32_t BUFFER_SIZE = 1 << 16;
+constexpr uint32_t SETTLE_INTERVAL = 1 << 10;
+constexpr uint32_t SETTLE_LIMIT = 1 << 14;
+
+// Must exceed the offset window plus two steps, so that a re-parse still finds intact links.
+
+constexpr uint32_t WORD_CHAIN_SIZE = 1 << 10;
+
+template<class FormatType>
+StreamingParser<FormatType>::StreamingParser(const FormatType& format, StepSink sink):
+    mFormat{format},
+    mSink{std::move(sink)},
+    mMaxStep{std::max(format.MaxLiteralLength(), format.MaxMatchLength())},
+    mBuffer(BUFFER_SIZE),
+    mNodes(BUFFER_SIZE + 1),
+    mBufferPos{0},
+    mInputEnd{0},
+    mParsePos{0},
+    mSettledPos{0},
+    mChainPos{0},
+    mWordHeads(65536, UINT64_MAX),
+    mWordChain(WORD_CHAIN_SIZE)
+{
+    mNodes[0].cost = 0;
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::Write(const uint8_t* pInput, size_t inputSize)
+{
+    while (inputSize > 0)
+    {
+        if (mInputEnd - mBufferPos == mBuffer.size())
+        {
+            Compact();
+        }
+
+        size_t size = std::min<size_t>(inputSize, mBuffer.size() - (mInputEnd - mBufferPos));
+        memcpy(mBuffer.data() + (mInputEnd - mBufferPos), pInput, size);
+
+        mInputEnd += size;
+        pInput += size;
+        inputSize -= size;
+
+        // A position is parsed once the longest step from it is available, so it sees the same literals and
+        // matches as in the whole input.
+
+        if (mInputEnd >= mMaxStep)
+        {
+            ParseUntil(mInputEnd - mMaxStep);
+        }
+    }
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::Finish()
+{
+    if (mInputEnd == 0)
+        return;
+
+    ParseUntil(mInputEnd);
+
+    // All paths end at the last node.
+
+    if (TracePath(mInputEnd))
+    {
+        PassSteps(mInputEnd);
+    }
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::ParseUntil(uint64_t endPos)
+{
+    while (mParsePos < endPos)
+    {
+        uint64_t inputPos = mParsePos++;
+        const PathNode& node = GetNode(inputPos);
+
+        // Propagate literals.
+
+        uint16_t maxLength = static_cast<uint16_t>(std::min<uint64_t>(mInputEnd - inputPos, mFormat.MaxLiteralLength()));
+
+        for (uint16_t length = 1; length <= maxLength; length++)
+        {
+            PathNode& nextNode = GetNode(inputPos + length);
+            uint64_t nextCost = node.cost + mFormat.GetLiteralCost(length);
+
+            if (nextCost <= nextNode.cost)
+            {
+                nextNode = PathNode{nextCost, length, 0};
+            }
+        }
+
+        // Propagate matches.
+
+        FindMatches(inputPos);
+
+        for (const MatchRange& match: mMatches)
+        {
+            for (uint16_t length = match.minLength; length <= match.maxLength; length++)
+            {
+                PathNode& nextNode = GetNode(inputPos + length);
+                uint64_t nextCost = node.cost + mFormat.GetMatchCost(length, match.offset);
+
+                if (nextCost <= nextNode.cost)
+                {
+                    nextNode = PathNode{nextCost, length, match.offset};
+                }
+            }
+        }
+
+        if (mParsePos % SETTLE_INTERVAL == 0)
+        {
+            SettleSteps(mParsePos - mSettledPos > SETTLE_LIMIT);
+        }
+    }
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::FindMatches(uint64_t inputPos)
+{
+    mMatches.clear();
+
+    if (inputPos + 1 >= mInputEnd)
+        return;
+
+    // Walk the chain of the 2-byte word from the most recent position (the lowest offset). Positions that are not
+    // behind the input position only occur when a forced settle parses a range again.
+
+    const uint8_t* pInput = GetInput(inputPos);
+    uint16_t word = pInput[0] | (pInput[1] << 8);
+    uint64_t windowPos = inputPos - std::min<uint64_t>(inputPos, mFormat.MaxMatchOffset());
+    uint16_t maxLength = static_cast<uint16_t>(std::min<uint64_t>(mInputEnd - inputPos, mFormat.MaxMatchLength()));
+    uint16_t coveredLength = 0;
+
+    // Only the lengths not already covered by a lower offset can win (see OptimalParser), so a match must
+    // extend past the covered length and the walk ends once the maximum length is covered.
+
+    for (uint64_t matchPos = mWordHeads[word]; matchPos != UINT64_MAX && matchPos >= windowPos && coveredLength < maxLength; matchPos = mWordChain[matchPos % WORD_CHAIN_SIZE])
+    {
+        const uint8_t* pMatch = GetInput(matchPos);
+
+        if (matchPos >= inputPos || pInput[coveredLength] != pMatch[coveredLength])
+            continue;
+
+        uint16_t length = 2;
+
+        while (length < maxLength && pInput[length] == pMatch[length])
+        {
+            length++;
+        }
+
+        if (length >= mFormat.MinMatchLength() && length > coveredLength)
+        {
+            uint16_t minLength = std::max<uint16_t>(mFormat.MinMatchLength(), coveredLength + 1);
+            mMatches.emplace_back(minLength, length, static_cast<uint16_t>(inputPos - matchPos));
+            coveredLength = length;
+        }
+    }
+
+    if (inputPos == mChainPos)
+    {
+        mWordChain[inputPos % WORD_CHAIN_SIZE] = mWordHeads[word];
+        mWordHeads[word] = inputPos;
+        mChainPos++;
+    }
+}
+
+template<class FormatType>
+bool StreamingParser<FormatType>::TracePath(uint64_t inputPos)
+{
+    mPath.clear();
+
+    while (inputPos > mSettledPos)
+    {
+        mPath.push_back(inputPos);
+        inputPos -= GetNode(inputPos).length;
+    }
+
+    mPath.push_back(inputPos);
+
+    return inputPos == mSettledPos;
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::SettleSteps(bool force)
+{
+    uint64_t frontierPos = mParsePos;
+    uint64_t firstPos = std::max(mSettledPos, frontierPos - std::min<uint64_t>(frontierPos, mMaxStep - 1));
+    uint64_t commonPos = mSettledPos;
+
+    if (force)
+    {
+        // Take the path of the highest node that passes through the settled position.
+
+        for (commonPos = frontierPos; !TracePath(commonPos); commonPos--)
+        {
+            if (commonPos == firstPos)
+                return;
+        }
+
+        // The last steps of that path are cut short by the frontier, so it is only settled up to a step behind
+        // it. The rest is parsed again and may still continue the last settled step.
+
+        commonPos = *std::find_if(mPath.begin(), mPath.end(), [&](uint64_t inputPos) { return inputPos + mMaxStep <= frontierPos; });
+
+        if (commonPos == mSettledPos)
+            return;
+    }
+    else
+    {
+        // Every coding path passes through one of the final nodes within a step from the frontier. The final
+        // parse goes through the settled position, so paths that skip it can be ignored. The others are followed
+        // back from the highest position down and joined where they meet, until a single one is left. The last
+        // node where paths were joined is common to all of them.
+
+        mJoinPos.assign(static_cast<size_t>(frontierPos - mSettledPos + 1), UINT64_MAX);
+        size_t pathCount = 0;
+
+        for (uint64_t inputPos = firstPos; inputPos <= frontierPos; inputPos++, pathCount++)
+        {
+            mJoinPos[inputPos - mSettledPos] = inputPos;
+        }
+
+        for (uint64_t inputPos = frontierPos; inputPos > mSettledPos; inputPos--)
+        {
+            uint64_t joinPos = mJoinPos[inputPos - mSettledPos];
+
+            if (joinPos == UINT64_MAX)
+                continue;
+
+            if (pathCount == 1)
+            {
+                commonPos = joinPos;
+                break;
+            }
+
+            uint16_t length = GetNode(inputPos).length;
+
+            if (inputPos - mSettledPos < length)
+            {
+                pathCount--;
+            }
+            else if (mJoinPos[inputPos - length - mSettledPos] != UINT64_MAX)
+            {
+                mJoinPos[inputPos - length - mSettledPos] = inputPos - length;
+                pathCount--;
+            }
+            else
+            {
+                mJoinPos[inputPos - length - mSettledPos] = joinPos;
+            }
+        }
+
+        if (commonPos == mSettledPos || !TracePath(commonPos))
+            return;
+    }
+
+    PassSteps(commonPos);
+
+    // Nodes ahead of the frontier may have been reached from elsewhere, so a forced settle parses them again
+    // from the settled node. All later paths then pass through it.
+
+    if (force)
+    {
+        for (uint64_t inputPos = commonPos + 1; inputPos <= std::min(frontierPos + mMaxStep, mInputEnd); inputPos++)
+        {
+            GetNode(inputPos) = PathNode{};
+        }
+
+        mParsePos = commonPos;
+        ParseUntil(frontierPos);
+    }
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::PassSteps(uint64_t endPos)
+{
+    // The traced path runs from its end down to the settled position.
+
+    mParse.clear();
+
+    for (auto iPos = mPath.rbegin() + 1; iPos != mPath.rend() && *iPos <= endPos; iPos++)
+    {
+        const PathNode& node = GetNode(*iPos);
+        mParse.emplace_back(node.length, node.offset);
+    }
+
+    mSink(GetInput(mSettledPos), mParse);
+    mSettledPos = endPos;
+}
+
+template<class FormatType>
+void StreamingParser<FormatType>::Compact()
+{
+    // Keep the unsettled input, the offset window and the nodes from the settled position onwards. If nothing
+    // has settled since the last compaction, nothing could be dropped, so a settle is forced first.
+
+    if (mSettledPos == mBufferPos)
+    {
+        SettleSteps(true);
+    }
+
+    uint64_t windowPos = mParsePos - std::min<uint64_t>(mParsePos, mFormat.MaxMatchOffset());
+    uint64_t keepPos = std::min(mSettledPos, windowPos);
+    size_t shift = static_cast<size_t>(keepPos - mBufferPos);
+    assert(shift > 0);
+
+    memmove(mBuffer.data(), mBuffer.data() + shift, static_cast<size_t>(mInputEnd - keepPos));
+
+    std::move(mNodes.begin() + shift, mNodes.end(), mNodes.begin());
+    std::fill(mNodes.end() - shift, mNodes.end(), PathNode{});
+
+    mBufferPos = keepPos;
+}
+
+template class StreamingParser<FormatLZM>;
+template class StreamingParser<FormatEF8>;
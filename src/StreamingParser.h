@@ -0,0 +1,90 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#ifndef STREAMING_PARSER_H
+#define STREAMING_PARSER_H
+
+#include <functional>
+#include <vector>
+#include "CommonTypes.h"
+#include "Formats.h"
+
+// Runs the optimal parse of OptimalParser over input that arrives in chunks. Only a window of the input and of
+// the path nodes is kept, and parse steps are passed on as soon as all coding paths agree on them. The result
+// is the same as the parse of the whole input unless the paths keep disagreeing for longer than the settle
+// limit (16 KiB), in which case the path of the frontier is taken up to a step behind it. Each such settle may
+// cost a few bytes, but equally expensive paths are resolved as in OptimalParser, so they rarely disagree for
+// that long.
+
+template<class FormatType>
+class StreamingParser
+{
+public:
+
+    // Receives settled parse steps together with the input they cover. The input is only valid during the call.
+
+    using StepSink = std::function<void(const uint8_t* pInput, const std::vector<ParseStep>& parse)>;
+
+    // Only instantiated for LZM and EF8.
+
+    StreamingParser(const FormatType& format, StepSink sink);
+    StreamingParser() = delete;
+
+    void Write(const uint8_t* pInput, size_t inputSize);
+
+    // Parses the rest of the input and passes on the remaining steps.
+
+    void Finish();
+
+    uint64_t InputSize() const { return mInputEnd; }
+
+private:
+
+    struct PathNode
+    {
+        uint64_t cost = UINT64_MAX;
+        uint16_t length = 0;
+        uint16_t offset = 0;
+    };
+
+    void ParseUntil(uint64_t endPos);
+    void FindMatches(uint64_t inputPos);
+    bool TracePath(uint64_t inputPos);
+    void SettleSteps(bool force);
+    void PassSteps(uint64_t endPos);
+    void Compact();
+
+    const uint8_t* GetInput(uint64_t inputPos) const { return mBuffer.data() + (inputPos - mBufferPos); }
+    PathNode& GetNode(uint64_t inputPos) { return mNodes[inputPos - mBufferPos]; }
+
+    const FormatType& mFormat;
+    StepSink mSink;
+
+    // A path node may be reached from this many positions back.
+
+    uint32_t mMaxStep;
+
+    // The buffers start at input position mBufferPos. Positions below mParsePos have propagated their paths,
+    // so nodes up to mParsePos are final. Steps up to mSettledPos have been passed on.
+
+    std::vector<uint8_t> mBuffer;
+    std::vector<PathNode> mNodes;
+    uint64_t mBufferPos;
+    uint64_t mInputEnd;
+    uint64_t mParsePos;
+    uint64_t mSettledPos;
+
+    // Chains of 2-byte word positions below mChainPos. Only the links within the offset window are followed, so
+    // a ring of them is enough.
+
+    uint64_t mChainPos;
+    std::vector<uint64_t> mWordHeads;
+    std::vector<uint64_t> mWordChain;
+
+    std::vector<MatchRange> mMatches;
+    std::vector<ParseStep> mParse;
+    std::vector<uint64_t> mPath;
+    std::vector<uint64_t> mJoinPos;
+};
+
+#endif // STREAMING_PARSER_H
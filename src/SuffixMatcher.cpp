@@ -0,0 +1,260 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#include "SuffixMatcher.h"
+#include <algorithm>
+
+SuffixMatcher::SuffixMatcher(const uint8_t* pInput, uint32_t inputSize, uint16_t minMatchLength, uint16_t maxMatchLength, uint16_t maxMatchOffset):
+    mInputPtr{pInput},
+    mInputSize{inputSize},
+    mMinMatchLength{minMatchLength},
+    mMaxMatchLength{maxMatchLength},
+    mMaxMatchOffset{maxMatchOffset},
+    mByteGroups{},
+    mBytePositions(inputSize),
+    mByteIndices(inputSize)
+{
+    if (inputSize < 2)
+        return;
+
+    // Group the input positions by byte value (counting sort).
+
+    uint32_t groupEnds[256] = {};
+
+    for (uint32_t inputPos = 0; inputPos < inputSize; inputPos++)
+    {
+        groupEnds[pInput[inputPos]]++;
+    }
+
+    for (uint32_t byte = 0, groupStart = 0; byte < 256; byte++)
+    {
+        mByteGroups[byte] = groupStart;
+        groupStart += groupEnds[byte];
+        groupEnds[byte] = mByteGroups[byte];
+    }
+
+    for (uint32_t inputPos = 0; inputPos < inputSize; inputPos++)
+    {
+        uint32_t index = groupEnds[pInput[inputPos]]++;
+        mBytePositions[index] = inputPos;
+        mByteIndices[inputPos] = index;
+    }
+
+    std::vector<uint32_t> suffixes;
+    BuildSuffixArray(suffixes);
+    BuildLcpTable(suffixes);
+}
+
+size_t SuffixMatcher::GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes, uint16_t maxOffset) const
+{
+    matches.clear();
+
+    // Walk the earlier positions of the same byte in descending order (ascending offsets) until the window ends.
+    // Only offsets with a common 2-byte prefix carry matches longer than one byte.
+
+    uint32_t windowPos = inputPos - std::min<uint32_t>(inputPos, std::min(mMaxMatchOffset, maxOffset));
+    uint32_t groupStart = mByteGroups[mInputPtr[inputPos]];
+
+    for (uint32_t index = mByteIndices[inputPos]; index-- > groupStart;)
+    {
+        uint32_t matchPos = mBytePositions[index];
+
+        if (matchPos < windowPos)
+            break;
+
+        uint16_t offset = inputPos - matchPos;
+        uint16_t length = GetMatchLength(inputPos, matchPos);
+
+        if (length >= 2 && length >= mMinMatchLength)
+        {
+            matches.emplace_back(allowBytes ? 1 : mMinMatchLength, length, offset);
+        }
+        else if (allowBytes)
+        {
+            matches.emplace_back(1, 1, offset);
+        }
+    }
+
+    return matches.size();
+}
+
+size_t SuffixMatcher::GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset) const
+{
+    matches.clear();
+
+    uint32_t windowPos = inputPos - std::min<uint32_t>(inputPos, std::min(mMaxMatchOffset, maxOffset));
+    uint32_t groupStart = mByteGroups[mInputPtr[inputPos]];
+
+    for (uint32_t index = mByteIndices[inputPos]; index-- > groupStart;)
+    {
+        uint32_t matchPos = mBytePositions[index];
+
+        if (matchPos < windowPos)
+            break;
+
+        matches.emplace_back(1, inputPos - matchPos);
+    }
+
+    return matches.size();
+}
+
+void SuffixMatcher::BuildSuffixArray(std::vector<uint32_t>& suffixes)
+{
+    // Prefix doubling. Each pass sorts the suffixes by their first 2k bytes using the ranks of the first k bytes
+    // as two radix keys. The suffixes are already grouped by their first byte.
+
+    suffixes = mBytePositions;
+
+    std::vector<uint32_t>& ranks = mRanks;
+    std::vector<uint32_t> nextRanks(mInputSize);
+    std::vector<uint32_t> order(mInputSize);
+    std::vector<uint32_t> counts(std::max<uint32_t>(mInputSize, 256));
+
+    ranks.resize(mInputSize);
+
+    for (uint32_t inputPos = 0; inputPos < mInputSize; inputPos++)
+    {
+        ranks[inputPos] = mInputPtr[inputPos];
+    }
+
+    uint32_t rankCount = 256;
+
+    for (uint32_t step = 1; ; step <<= 1)
+    {
+        // Order by the second key. Suffixes shorter than the step come first (their second key is empty).
+
+        uint32_t orderSize = 0;
+
+        for (uint32_t inputPos = mInputSize - std::min(step, mInputSize); inputPos < mInputSize; inputPos++)
+        {
+            order[orderSize++] = inputPos;
+        }
+
+        for (uint32_t suffix: suffixes)
+        {
+            if (suffix >= step)
+            {
+                order[orderSize++] = suffix - step;
+            }
+        }
+
+        // Stable counting sort by the first key.
+
+        std::fill(counts.begin(), counts.begin() + rankCount, 0);
+
+        for (uint32_t inputPos = 0; inputPos < mInputSize; inputPos++)
+        {
+            counts[ranks[inputPos]]++;
+        }
+
+        for (uint32_t rank = 0, sum = 0; rank < rankCount; rank++)
+        {
+            uint32_t count = counts[rank];
+            counts[rank] = sum;
+            sum += count;
+        }
+
+        for (uint32_t suffix: order)
+        {
+            suffixes[counts[ranks[suffix]]++] = suffix;
+        }
+
+        // Assign new ranks to the groups of equal key pairs.
+
+        auto GetSecondKey = [&](uint32_t suffix) { return suffix + step < mInputSize ? ranks[suffix + step] : UINT32_MAX; };
+
+        nextRanks[suffixes[0]] = 0;
+
+        for (uint32_t i = 1; i < mInputSize; i++)
+        {
+            uint32_t prevSuffix = suffixes[i - 1];
+            uint32_t suffix = suffixes[i];
+            bool isEqual = ranks[prevSuffix] == ranks[suffix] && GetSecondKey(prevSuffix) == GetSecondKey(suffix);
+
+            nextRanks[suffix] = nextRanks[prevSuffix] + !isEqual;
+        }
+
+        std::swap(ranks, nextRanks);
+        rankCount = ranks[suffixes[mInputSize - 1]] + 1;
+
+        if (rankCount == mInputSize)
+            break;
+    }
+}
+
+void SuffixMatcher::BuildLcpTable(const std::vector<uint32_t>& suffixes)
+{
+    // Kasai's algorithm. The first level holds the common prefix length of each suffix and its predecessor in
+    // sorted order (capped at the maximum match length).
+
+    uint32_t levelCount = 1;
+
+    while ((mInputSize >> levelCount) > 0)
+    {
+        levelCount++;
+    }
+
+    mLcpTable.resize(static_cast<size_t>(levelCount) * mInputSize);
+
+    for (uint32_t inputPos = 0, length = 0; inputPos < mInputSize; inputPos++)
+    {
+        uint32_t rank = mRanks[inputPos];
+
+        if (rank == 0)
+        {
+            length = 0;
+            continue;
+        }
+
+        uint32_t prevSuffix = suffixes[rank - 1];
+
+        while (inputPos + length < mInputSize && prevSuffix + length < mInputSize &&
+            mInputPtr[inputPos + length] == mInputPtr[prevSuffix + length])
+        {
+            length++;
+        }
+
+        mLcpTable[rank] = static_cast<uint16_t>(std::min<uint32_t>(length, mMaxMatchLength));
+
+        if (length > 0)
+        {
+            length--;
+        }
+    }
+
+    // Each further level holds the minima of twice as long rank ranges.
+
+    for (uint32_t level = 1; level < levelCount; level++)
+    {
+        const uint16_t* pPrevLevel = &mLcpTable[static_cast<size_t>(level - 1) * mInputSize];
+        uint16_t* pLevel = &mLcpTable[static_cast<size_t>(level) * mInputSize];
+        uint32_t halfSize = 1 << (level - 1);
+
+        for (uint32_t rank = 0; rank + (halfSize << 1) <= mInputSize; rank++)
+        {
+            pLevel[rank] = std::min(pPrevLevel[rank], pPrevLevel[rank + halfSize]);
+        }
+    }
+
+    mLog2.resize(mInputSize + 1);
+
+    for (uint32_t size = 2; size <= mInputSize; size++)
+    {
+        mLog2[size] = mLog2[size >> 1] + 1;
+    }
+}
+
+uint16_t SuffixMatcher::GetMatchLength(uint32_t inputPos, uint32_t matchPos) const
+{
+    // Most candidates diverge at the second byte, so test it before the range query.
+
+    if (inputPos + 1 >= mInputSize || mInputPtr[inputPos + 1] != mInputPtr[matchPos + 1])
+        return 1;
+
+    uint32_t firstRank = std::min(mRanks[inputPos], mRanks[matchPos]) + 1;
+    uint32_t lastRank = std::max(mRanks[inputPos], mRanks[matchPos]);
+    uint8_t level = mLog2[lastRank - firstRank + 1];
+
+    const uint16_t* pLevel = &mLcpTable[static_cast<size_t>(level) * mInputSize];
+    return std::min(pLevel[firstRank], pLevel[lastRank + 1 - (1 << level)]);
+}
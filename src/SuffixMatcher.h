@@ -0,0 +1,58 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#ifndef SUFFIX_MATCHER_H
+#define SUFFIX_MATCHER_H
+
+#include <vector>
+#include "MatchFinder.h"
+
+// Finds matches using a suffix array. The length of the common prefix of any two suffixes is the minimum of the
+// LCP array between their ranks, answered in constant time by a sparse table. Nothing is stored per match, so
+// the construction time and memory footprint do not depend on how repetitive the input is.
+
+class SuffixMatcher final: public MatchFinder
+{
+public:
+
+    SuffixMatcher() = delete;
+
+    SuffixMatcher(
+        const uint8_t* pInput,
+        uint32_t inputSize,
+        uint16_t minMatchLength,
+        uint16_t maxMatchLength,
+        uint16_t maxMatchOffset
+    );
+
+    size_t GetMatches(std::vector<MatchRange>& matches, uint32_t inputPos, bool allowBytes = false, uint16_t maxOffset = UINT16_MAX) const override;
+    size_t GetByteMatches(std::vector<Match>& matches, uint32_t inputPos, uint16_t maxOffset = UINT16_MAX) const override;
+
+private:
+
+    void BuildSuffixArray(std::vector<uint32_t>& suffixes);
+    void BuildLcpTable(const std::vector<uint32_t>& suffixes);
+
+    uint16_t GetMatchLength(uint32_t inputPos, uint32_t matchPos) const;
+
+    const uint8_t* mInputPtr;
+    const uint32_t mInputSize;
+
+    const uint16_t mMinMatchLength;
+    const uint16_t mMaxMatchLength;
+    const uint16_t mMaxMatchOffset;
+
+    // Input positions grouped by byte value (ascending within each group).
+
+    uint32_t mByteGroups[256];
+    std::vector<uint32_t> mBytePositions;
+    std::vector<uint32_t> mByteIndices;
+
+    // Suffix ranks and the sparse table of LCP minima (level k covers 2^k consecutive ranks).
+
+    std::vector<uint32_t> mRanks;
+    std::vector<uint16_t> mLcpTable;
+    std::vector<uint8_t> mLog2;
+};
+
+#endif // SUFFIX_MATCHER_H
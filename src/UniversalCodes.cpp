@@ -2,8 +2,52 @@
 // This code is licensed under the BSD 2-Clause License.
 
 #include "UniversalCodes.h"
+#include <algorithm>
 #include <cassert>
 
+// Codes are written with as few multi-bit writes as possible. Runs of ones are written ahead in chunks, so
+// that the rest of the code fits into a single write.
+
+static uint32_t WriteLeadingOnes(BitStream& stream, uint32_t count, uint32_t maxCount)
+{
+    while (count > maxCount)
+    {
+        uint32_t chunk = std::min(count - maxCount, 32u);
+        stream.WriteBits(0xFFFFFFFF >> (32 - chunk), chunk);
+        count -= chunk;
+    }
+
+    return count;
+}
+
+// Reads a run of ones and the zero that terminates it, a byte at a time.
+
+static uint32_t ReadLeadingOnes(BitStream& stream)
+{
+    uint32_t count = 0;
+
+    while (true)
+    {
+        uint32_t bits = stream.PeekBits(8);
+        uint32_t ones = 0;
+
+        while (ones < 8 && (bits & (0x80 >> ones)))
+        {
+            ones++;
+        }
+
+        count += ones;
+
+        if (ones < 8)
+        {
+            stream.SkipBits(ones + 1);
+            return count;
+        }
+
+        stream.SkipBits(8);
+    }
+}
+
 // Elias-Gamma 1..N encoding (interleaved format).
 
 // 1: 0
@@ -28,35 +72,143 @@ uint32_t GetEliasCost(uint32_t value)
     return cost;
 }
 
+const uint32_t* GetEliasCostTable()
+{
+    // Built on first use (initialization of local statics is thread-safe). Index 0 is used as sentinel.
+
+    struct EliasCostTable
+    {
+        EliasCostTable()
+        {
+            costs[0] = 0xFFFFFFFF;
+
+            for (uint32_t i = 1; i < 65536; i++)
+            {
+                costs[i] = GetEliasCost(i);
+            }
+        }
+
+        uint32_t costs[65536];
+    };
+
+    static const EliasCostTable table;
+    return table.costs;
+}
+
+const uint32_t* GetEliasCodeTable()
+{
+    // Codes of values 1..65535 (the bit count equals the cost). Index 0 is unused.
+
+    struct EliasCodeTable
+    {
+        EliasCodeTable()
+        {
+            codes[0] = 0;
+
+            for (uint32_t i = 1; i < 65536; i++)
+            {
+                uint32_t code = 0;
+
+                for (uint32_t mask = 0x8000 >> (15 - (GetEliasCost(i) >> 1)); mask >>= 1;)
+                {
+                    code = (code << 2) | 2 | ((i & mask) != 0);
+                }
+
+                codes[i] = code << 1;
+            }
+        }
+
+        uint32_t codes[65536];
+    };
+
+    static const EliasCodeTable table;
+    return table.codes;
+}
+
 void EncodeElias(BitStream& stream, uint32_t value)
 {
     assert(value > 0);
 
-    uint32_t mask = 1;
-    uint32_t temp = value;
+    static const uint32_t* pCodes = GetEliasCodeTable();
+    static const uint32_t* pCosts = GetEliasCostTable();
 
-    while (temp >>= 1)
+    if (value < 65536)
     {
-        mask <<= 1;
+        stream.WriteBits(pCodes[value], pCosts[value]);
+        return;
     }
 
-    while (mask >>= 1)
+    // Larger values are split into the code of the upper 16 bits without its terminating zero, the remaining
+    // bit pairs and the terminating zero.
+
+    uint32_t shift = 0;
+    while ((value >> shift) >= 65536)
     {
-        stream.WriteBit(1);
-        stream.WriteBit(value & mask);
+        shift++;
+    }
+
+    uint32_t upper = value >> shift;
+    stream.WriteBits(pCodes[upper] >> 1, pCosts[upper] - 1);
+
+    uint32_t code = 0;
+    for (uint32_t mask = 1 << shift; mask >>= 1;)
+    {
+        code = (code << 2) | 2 | ((value & mask) != 0);
     }
 
+    stream.WriteBits(code, 2 * shift);
     stream.WriteBit(0);
 }
 
 uint32_t DecodeElias(BitStream& stream, uint32_t value)
 {
-    while (stream.ReadBit())
+    // Decoded a byte at a time. Each entry holds the data bits of the flag/bit pairs in 8 bits of the stream and
+    // the number of bits they take, which is odd if the terminating zero is among them.
+
+    struct EliasDecodeTable
     {
-        value = (value << 1) | stream.ReadBit();
-    }
+        EliasDecodeTable()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                Entry& entry = entries[i];
+                entry = {0, 0, 8};
+
+                for (uint32_t pair = 0; pair < 4; pair++)
+                {
+                    if ((i & (0x80 >> (pair << 1))) == 0)
+                    {
+                        entry.bitCount = static_cast<uint8_t>((pair << 1) + 1);
+                        break;
+                    }
+
+                    entry.bits = static_cast<uint8_t>((entry.bits << 1) | ((i >> (6 - (pair << 1))) & 1));
+                    entry.pairCount++;
+                }
+            }
+        }
 
-    return value;
+        struct Entry
+        {
+            uint8_t bits;
+            uint8_t pairCount;
+            uint8_t bitCount;
+        };
+
+        Entry entries[256];
+    };
+
+    static const EliasDecodeTable table;
+
+    while (true)
+    {
+        const EliasDecodeTable::Entry& entry = table.entries[stream.PeekBits(8)];
+        stream.SkipBits(entry.bitCount);
+        value = (value << entry.pairCount) | entry.bits;
+
+        if (entry.bitCount & 1)
+            return value;
+    }
 }
 
 // Unary encoding.
@@ -77,24 +229,13 @@ uint32_t GetUnaryCost(uint32_t value)
 
 void EncodeUnary(BitStream& stream, uint32_t value)
 {
-    for (uint32_t i = 0; i < value; i++)
-    {
-        stream.WriteBit(1);
-    }
-
-    stream.WriteBit(0);
+    uint32_t count = WriteLeadingOnes(stream, value, 31);
+    stream.WriteBits(((1u << count) - 1) << 1, count + 1);
 }
 
 uint32_t DecodeUnary(BitStream& stream)
 {
-    uint32_t value = 0;
-
-    while (stream.ReadBit())
-    {
-        value++;
-    }
-
-    return value;
+    return ReadLeadingOnes(stream);
 }
 
 // Rice encoding (K = 1).
@@ -115,24 +256,13 @@ uint32_t GetRiceCost(uint32_t value)
 
 void EncodeRice(BitStream& stream, uint32_t value)
 {
-    for (uint32_t i = 0; i < value >> 1; i++)
-    {
-        stream.WriteBit(1);
-    }
-
-    stream.WriteBit(0);
-    stream.WriteBit(value & 1);
+    uint32_t count = WriteLeadingOnes(stream, value >> 1, 30);
+    stream.WriteBits((((1u << count) - 1) << 2) | (value & 1), count + 2);
 }
 
 uint32_t DecodeRice(BitStream& stream)
 {
-    uint32_t value = 0;
-
-    while (stream.ReadBit())
-    {
-        value++;
-    }
-
+    uint32_t value = ReadLeadingOnes(stream);
     return (value << 1) | stream.ReadBit();
 }
 
@@ -154,17 +284,8 @@ uint32_t GetVbinCost(uint32_t value)
 
 void EncodeVbin(BitStream& stream, uint32_t value)
 {
-    uint32_t count = value / 3;
-
-    for (uint32_t i = 0; i < count; i++)
-    {
-        stream.WriteBit(1);
-        stream.WriteBit(1);
-        value -= 3;
-    }
-
-    stream.WriteBit(value & 2);
-    stream.WriteBit(value & 1);
+    uint32_t count = WriteLeadingOnes(stream, (value / 3) << 1, 30);
+    stream.WriteBits((((1u << count) - 1) << 2) | (value % 3), count + 2);
 }
 
 uint32_t DecodeVbin(BitStream& stream)
@@ -173,8 +294,7 @@ uint32_t DecodeVbin(BitStream& stream)
 
     while (true)
     {
-        uint32_t bits = stream.ReadBit();
-        bits = (bits << 1) | stream.ReadBit();
+        uint32_t bits = stream.ReadBits(2);
         value += bits;
 
         if ((bits & 3) < 3)
@@ -192,13 +312,9 @@ void EncodeRaw(BitStream& stream, uint32_t value, uint32_t bitCount)
 {
     assert(bitCount > 0);
 
-    uint32_t mask = 1 << (bitCount - 1);
+    assert(bitCount <= 32);
 
-    while (mask)
-    {
-        stream.WriteBit(value & mask);
-        mask >>= 1;
-    }
+    stream.WriteBits(value & (0xFFFFFFFF >> (32 - bitCount)), bitCount);
 }
 
 uint32_t DecodeRaw(BitStream& stream, uint32_t bitCount)
@@ -207,12 +323,12 @@ uint32_t DecodeRaw(BitStream& stream, uint32_t bitCount)
 
     uint32_t value = 0;
 
-    while (bitCount--)
+    for (; bitCount > 16; bitCount -= 16)
     {
-        value = (value << 1) | stream.ReadBit();
+        value = (value << 16) | stream.ReadBits(16);
     }
 
-    return value;
+    return (value << bitCount) | stream.ReadBits(bitCount);
 }
 
 // Only used by the BX0 format.
@@ -226,6 +342,18 @@ bool EncodeEliasWithoutFlag(BitStream& stream, uint32_t value)
         return false;
     }
 
+    // The code equals the Elias-Gamma code without its leading flag.
+
+    if (value < 65536)
+    {
+        static const uint32_t* pCodes = GetEliasCodeTable();
+        static const uint32_t* pCosts = GetEliasCostTable();
+
+        uint32_t bitCount = pCosts[value] - 1;
+        stream.WriteBits(pCodes[value] & ((1u << bitCount) - 1), bitCount);
+        return true;
+    }
+
     uint32_t mask = 1;
     uint32_t temp = value >> 1;
 
@@ -246,13 +374,12 @@ bool EncodeEliasWithoutFlag(BitStream& stream, uint32_t value)
 
 uint32_t DecodeEliasWithFlag(BitStream& stream, bool flag)
 {
-    uint32_t value = 1;
+    // After the first data bit, the rest is an ordinary Elias-Gamma continuation.
 
-    while (flag)
+    if (!flag)
     {
-        value = (value << 1) | stream.ReadBit();
-        flag = stream.ReadBit();
+        return 1;
     }
 
-    return value;
+    return DecodeElias(stream, 2 | stream.ReadBit());
 }
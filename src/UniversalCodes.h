@@ -7,6 +7,8 @@
 #include "BitStream.h"
 
 uint32_t GetEliasCost(uint32_t value);
+const uint32_t* GetEliasCostTable();
+const uint32_t* GetEliasCodeTable();
 void EncodeElias(BitStream& stream, uint32_t value);
 uint32_t DecodeElias(BitStream& stream, uint32_t value = 1);
 
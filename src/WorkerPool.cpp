@@ -0,0 +1,118 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+{
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        mWorkers.emplace_back(&WorkerPool::WorkerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+
+    mStartCondition.notify_all();
+
+    for (std::thread& worker: mWorkers)
+    {
+        worker.join();
+    }
+}
+
+void WorkerPool::Run(uint32_t taskCount, const std::function<void(uint32_t)>& task)
+{
+    if (mWorkers.empty() || taskCount <= 1)
+    {
+        for (uint32_t taskIndex = 0; taskIndex < taskCount; taskIndex++)
+        {
+            task(taskIndex);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mpTask = &task;
+        mTaskCount = taskCount;
+        mNextTask = 0;
+        mBusyCount = static_cast<uint32_t>(mWorkers.size());
+        mBatchId++;
+    }
+
+    mStartCondition.notify_all();
+    RunTasks();
+
+    // Workers only leave the batch once there are no tasks left, so the batch is over when all of them are idle.
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFinishCondition.wait(lock, [this]() { return mBusyCount == 0; });
+    mpTask = nullptr;
+
+    if (mException)
+    {
+        std::exception_ptr exception;
+        std::swap(exception, mException);
+
+        lock.unlock();
+        std::rethrow_exception(exception);
+    }
+}
+
+void WorkerPool::WorkerLoop()
+{
+    uint32_t batchId = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mStartCondition.wait(lock, [&]() { return mStop || mBatchId != batchId; });
+
+            if (mStop)
+                return;
+
+            batchId = mBatchId;
+        }
+
+        RunTasks();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (--mBusyCount == 0)
+        {
+            mFinishCondition.notify_one();
+        }
+    }
+}
+
+void WorkerPool::RunTasks()
+{
+    for (uint32_t taskIndex = mNextTask++; taskIndex < mTaskCount; taskIndex = mNextTask++)
+    {
+        try
+        {
+            (*mpTask)(taskIndex);
+        }
+        catch (...)
+        {
+            // Keep the first exception for the caller of Run and skip the tasks that have not started yet.
+
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if (!mException)
+            {
+                mException = std::current_exception();
+            }
+
+            mNextTask = mTaskCount;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2025, Milos "baze" Bazelides
+// This code is licensed under the BSD 2-Clause License.
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that execute batches of tasks. The calling thread takes part in each batch, so a pool
+// of N threads only starts N - 1 workers.
+
+class WorkerPool
+{
+public:
+
+    WorkerPool() = delete;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator = (const WorkerPool&) = delete;
+
+    WorkerPool(uint32_t threadCount);
+    ~WorkerPool();
+
+    uint32_t ThreadCount() const { return static_cast<uint32_t>(mWorkers.size()) + 1; }
+
+    // Calls task(taskIndex) for all indices from 0 to taskCount - 1 and waits until all of them are finished.
+    // Tasks are handed out in ascending order, but may run concurrently and finish in any order. If a task
+    // throws, no further tasks are handed out and the first exception is rethrown once the running ones end.
+
+    void Run(uint32_t taskCount, const std::function<void(uint32_t)>& task);
+
+private:
+
+    void WorkerLoop();
+    void RunTasks();
+
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;
+    std::condition_variable mStartCondition;
+    std::condition_variable mFinishCondition;
+
+    const std::function<void(uint32_t)>* mpTask = nullptr;
+    uint32_t mTaskCount = 0;
+    uint32_t mBatchId = 0;
+    uint32_t mBusyCount = 0;
+    bool mStop = false;
+
+    std::atomic<uint32_t> mNextTask{0};
+    std::exception_ptr mException;
+};
+
+#endif // WORKER_POOL_H